@@ -234,6 +234,9 @@ extern int isInCheck(Board_t self);
 // Is move legal? Move must come from generateMoves, so be safe to make.
 extern bool isLegalMove(Board_t self, int move);
 
+// Does the move give check? Special moves always count as checking moves.
+extern bool isCheckingMove(Board_t self, int move);
+
 // Search tree to fixed depth for correctness testing
 extern long long moveTest(Board_t self, int depth);
 
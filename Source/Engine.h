@@ -20,6 +20,7 @@
 #define maxDepth 120
 #define nrKillers 5
 #define newKillerIndex 2
+#define nrPieceTo (13 * 64) // For history tables indexed by [piece][square]
 
 typedef struct Engine *Engine_t;
 
@@ -63,6 +64,14 @@ struct ttSlot {
 
 typedef Tuple(int, nrKillers) killersTuple;
 
+// Root move with its results from the last iteration, for ordering
+struct rootMove {
+        int move;               // move list entry, as in pvSearch
+        int score;              // last score, or a bound when not in the PV
+        long long nodeCount;    // size of its subtree
+        intList pv;             // line for MultiPV, empty if not in the top lines
+};
+
 #define ply(self) (board(self)->plyNumber - (self)->rootPlyNumber)
 
 /*
@@ -73,7 +82,11 @@ struct Engine {
 
         int rootPlyNumber;
         intList searchMoves;    // root moves to search, empty means all
+        List(struct rootMove) rootMoves; // persists between iterations
+        int multiPv;            // number of lines to search with open window
         bool mateStop;          // stops the search once the shortest mate is found
+        bool pds;               // probability density search instead of PVS
+        bool mtd;               // MTD(f) zero-window driver instead of PVS
 
         // transposition table
         struct {
@@ -84,8 +97,20 @@ struct Engine {
                 uint64_t baseHash; // For fast clearing
         } tt;
 
+        // proof-number mate solver, allocated on demand
+        struct {
+                struct mateSlot *slots;
+        } mateTable;
+
+        // move ordering
         List(killersTuple) killers;
-        short historyCounts[4096];
+        short historyCounts[4096];              // [from][to]
+        short pieceToHistory[nrPieceTo];        // [piece][to]
+        short captureHistory[nrPieceTo][8];     // [piece][to][victim type]
+        short counterMoves[nrPieceTo];          // by previous move [piece][to]
+        short (*continuationHistory)[nrPieceTo];// by move 1 or 2 plies back, allocated on demand
+        intList continuationKeys;               // [piece][to] index of the last move, per ply
+        bool ageHistory;                        // age instead of clear when the root changes
 
         // last search result
         struct {
@@ -105,14 +130,20 @@ struct Engine {
                 int depth;
                 long long nodeCount; // also used to abort the search
                 intPair scores;
+                int mate; // moves to mate for mateSearch, negative for being mated
+                double nodeRate; // nodes per second when the clock runs on nodes, or 0
+                double moveOverhead; // communication lag to reserve per move
+                bool watchCpuTime; // spend less when the search thread gets less CPU
         } target;
 
         searchInfo_fn *infoFunction;
         void *infoData;
 
         volatile bool pondering;
+        xEvent_t ponderEnd;     // set on `ponderhit' or `stop'
         xAlarm_t alarmHandle;
         void *abortTarget;
+        volatile double abortTime; // when abortSearch was last called
 };
 
 /*
@@ -140,6 +171,8 @@ extern bool globalVectorChanged;
  *  Search
  */
 void rootSearch(Engine_t self);
+void mateSearch(Engine_t self); // proof-number search for target.mate
+struct rootMove *findRootMove(Engine_t self, int move); // null if not a root move
 searchInfo_fn noInfoFunction;
 void abortSearch(void *engine);
 
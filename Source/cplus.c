@@ -137,6 +137,36 @@ double xTime(void)
 }
 #endif
 
+/*----------------------------------------------------------------------+
+ |      xThreadTime                                                     |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Get CPU time used by the calling thread in seconds
+ */
+
+#if defined(_WIN32)
+double xThreadTime(void)
+{
+        FILETIME creation, exit, kernel, user;
+        if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+                xAbort(GetLastError(), "GetThreadTimes");
+        ULARGE_INTEGER k = { .LowPart = kernel.dwLowDateTime, .HighPart = kernel.dwHighDateTime };
+        ULARGE_INTEGER u = { .LowPart = user.dwLowDateTime, .HighPart = user.dwHighDateTime };
+        return (k.QuadPart + u.QuadPart) * 1e-7; // 100 nanosecond units
+}
+#endif
+
+#if defined(POSIX)
+double xThreadTime(void)
+{
+        struct timespec ts;
+        int r = clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        if (r == -1) xAbort(errno, "clock_gettime");
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+#endif
+
 /*----------------------------------------------------------------------+
  |      stringCopy                                                      |
  +----------------------------------------------------------------------*/
@@ -304,28 +334,157 @@ void joinThread(xThread_t thread)
 #endif
 
 /*----------------------------------------------------------------------+
- |      Alarms (Windows)                                                |
+ |      Timer lock (Windows)                                            |
  +----------------------------------------------------------------------*/
 #if defined(_WIN32)
 
-// TODO: check and abort on all error conditions of win32 functions
+static SRWLOCK timerLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE timerCond = CONDITION_VARIABLE_INIT;
+
+static void lockTimer(void)
+{
+        AcquireSRWLockExclusive(&timerLock);
+}
+
+static void unlockTimer(void)
+{
+        ReleaseSRWLockExclusive(&timerLock);
+}
+
+static void notifyTimer(void)
+{
+        WakeAllConditionVariable(&timerCond);
+}
+
+// Wait for a notification or until the deadline, or indefinitely when it is 0
+static void waitTimer(double deadline)
+{
+        DWORD millis = INFINITE;
+        if (deadline > 0.0)
+                millis = ceil(max(0.0, deadline - xTime()) * 1e3);
+        SleepConditionVariableSRW(&timerCond, &timerLock, millis, 0);
+}
+
+static void timerThreadMain(void);
+
+static unsigned int __stdcall timerThreadStart(void *args)
+{
+        unused(args);
+        timerThreadMain();
+        return 0;
+}
+
+static void startTimerThread(void)
+{
+        HANDLE thread = (HANDLE) _beginthreadex(
+                null, 0, timerThreadStart, null, 0, null);
+        if (!thread) xAbort(errno, "_beginthreadex");
+        CloseHandle(thread); // Runs until the process exits
+}
+#endif
+
+/*----------------------------------------------------------------------+
+ |      Timer lock (POSIX)                                              |
+ +----------------------------------------------------------------------*/
+#if defined(POSIX)
+
+static pthread_mutex_t timerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timerCond = PTHREAD_COND_INITIALIZER;
+
+static void lockTimer(void)
+{
+        int r = pthread_mutex_lock(&timerLock);
+        cAbort(r, "pthread_mutex_lock");
+}
+
+static void unlockTimer(void)
+{
+        int r = pthread_mutex_unlock(&timerLock);
+        cAbort(r, "pthread_mutex_unlock");
+}
+
+static void notifyTimer(void)
+{
+        int r = pthread_cond_broadcast(&timerCond);
+        cAbort(r, "pthread_cond_broadcast");
+}
+
+// Wait for a notification or until the deadline, or indefinitely when it is 0
+static void waitTimer(double deadline)
+{
+        int r;
+        if (deadline > 0.0) {
+                struct timespec abstime;
+                abstime.tv_sec = deadline;
+                abstime.tv_nsec = fmod(deadline, 1.0) * 1e9;
+                r = pthread_cond_timedwait(&timerCond, &timerLock, &abstime);
+                if (r == ETIMEDOUT)
+                        return;
+        } else
+                r = pthread_cond_wait(&timerCond, &timerLock);
+        cAbort(r, "pthread_cond_wait");
+}
+
+static void timerThreadMain(void);
+
+static void *timerThreadStart(void *args)
+{
+        unused(args);
+        timerThreadMain();
+        return null;
+}
+
+static void startTimerThread(void)
+{
+        pthread_t thread;
+        int r = pthread_create(&thread, null, timerThreadStart, null);
+        cAbort(r, "pthread_create");
+        r = pthread_detach(thread); // Runs until the process exits
+        cAbort(r, "pthread_detach");
+}
+#endif
+
+/*----------------------------------------------------------------------+
+ |      Alarms                                                          |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  All alarms share one timer thread that sleeps until the earliest
+ *  deadline in its queue. Alarm functions therefore run one at a time
+ *  on that thread and must return quickly.
+ */
 
 struct alarmHandle {
-        double delay;
+        double deadline;
         thread_fn *function;
         void *data;
-        HANDLE event;
-        HANDLE thread;
+        struct alarmHandle *next;
 };
 
-static unsigned int __stdcall alarmThreadStart(void *args)
+// Shared timer state, protected by the timer lock
+static bool timerStarted;
+static struct alarmHandle *timerQueue;  // Pending alarms, earliest first
+static struct alarmHandle *timerFiring; // Alarm whose function is running
+
+static void timerThreadMain(void)
 {
-        struct alarmHandle *alarm = args;
-        DWORD millis = ceil(alarm->delay * 1e3);
-        DWORD r = WaitForSingleObject(alarm->event, millis);
-        if (r == WAIT_TIMEOUT)
-                alarm->function(alarm->data);
-        return 0;
+        lockTimer();
+        for (;;) {
+                struct alarmHandle *alarm = timerQueue;
+                if (alarm == null)
+                        waitTimer(0.0);
+                else if (alarm->deadline > xTime())
+                        waitTimer(alarm->deadline);
+                else {
+                        timerQueue = alarm->next;
+                        timerFiring = alarm;
+                        unlockTimer();
+                        alarm->function(alarm->data);
+                        lockTimer();
+                        timerFiring = null;
+                        notifyTimer(); // For clearAlarm
+                }
+        }
 }
 
 xAlarm_t setAlarm(double delay, thread_fn *function, void *data)
@@ -333,126 +492,154 @@ xAlarm_t setAlarm(double delay, thread_fn *function, void *data)
         struct alarmHandle *alarm = malloc(sizeof(*alarm));
         if (!alarm) xAbort(errno, "malloc");
 
-        alarm->delay = delay;
+        alarm->deadline = xTime() + delay;
         alarm->function = function;
         alarm->data = data;
-        alarm->event = CreateEvent(null, true, false, null);
-        alarm->thread = (HANDLE) _beginthreadex(
-                null, 0, alarmThreadStart, alarm, 0, null);
+
+        lockTimer();
+        if (!timerStarted) {
+                startTimerThread();
+                timerStarted = true;
+        }
+        struct alarmHandle **p = &timerQueue;
+        while (*p != null && (*p)->deadline <= alarm->deadline)
+                p = &(*p)->next;
+        alarm->next = *p;
+        *p = alarm;
+        notifyTimer();
+        unlockTimer();
 
         return alarm;
 }
 
 void clearAlarm(xAlarm_t alarm)
 {
-        if (alarm) {
-                SetEvent(alarm->event);
-                WaitForSingleObject(alarm->thread, INFINITE);
-                CloseHandle(alarm->thread);
-                CloseHandle(alarm->event);
-                free(alarm);
-        }
+        if (alarm == null)
+                return;
+
+        lockTimer();
+        for (struct alarmHandle **p=&timerQueue; *p!=null; p=&(*p)->next)
+                if (*p == alarm) {
+                        *p = alarm->next;
+                        break;
+                }
+        while (timerFiring == alarm) // Let a running alarm function finish
+                waitTimer(0.0);
+        unlockTimer();
+
+        free(alarm);
 }
-#endif
 
 /*----------------------------------------------------------------------+
- |      Alarms (POSIX)                                                  |
+ |      Events (Windows)                                                |
  +----------------------------------------------------------------------*/
-#if defined(POSIX)
+#if defined(_WIN32)
 
-struct alarmHandle {
-        pthread_mutex_t mutex;
-        pthread_cond_t cond;
-        struct timespec abstime;
-        bool abort;
-        thread_fn *function;
-        void *data;
-        pthread_t thread;
-};
+xEvent_t createEvent(void)
+{
+        HANDLE event = CreateEvent(null, true, false, null); // Manual reset
+        if (!event) xAbort(GetLastError(), "CreateEvent");
+        return (xEvent_t) event;
+}
 
-static void *alarmThreadStart(void *args)
+void destroyEvent(xEvent_t event)
 {
-        struct alarmHandle *alarm = args;
-        int r;
+        if (event)
+                CloseHandle((HANDLE) event);
+}
 
-        r = pthread_mutex_lock(&alarm->mutex);
-        cAbort(r, "pthread_mutex_lock");
+void setEvent(xEvent_t event)
+{
+        SetEvent((HANDLE) event);
+}
 
-        while (!alarm->abort) {
-                r = pthread_cond_timedwait(&alarm->cond, &alarm->mutex, &alarm->abstime);
-                if (r == ETIMEDOUT)
-                        break;
-                cAbort(r, "pthread_cond_timedwait");
-        }
+void resetEvent(xEvent_t event)
+{
+        ResetEvent((HANDLE) event);
+}
 
-        r = pthread_mutex_unlock(&alarm->mutex);
-        cAbort(r, "pthread_mutex_unlock");
+void waitEvent(xEvent_t event)
+{
+        WaitForSingleObject((HANDLE) event, INFINITE);
+}
+#endif
 
-        if (!alarm->abort)
-                alarm->function(alarm->data);
+/*----------------------------------------------------------------------+
+ |      Events (POSIX)                                                  |
+ +----------------------------------------------------------------------*/
+#if defined(POSIX)
 
-        return null;
-}
+struct eventHandle {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        bool isSet;
+};
 
-xAlarm_t setAlarm(double delay, thread_fn *function, void *data)
+xEvent_t createEvent(void)
 {
-        struct alarmHandle *alarm = malloc(sizeof(*alarm));
-        if (!alarm) xAbort(errno, "malloc");
+        struct eventHandle *event = malloc(sizeof(*event));
+        if (!event) xAbort(errno, "malloc");
 
-        int r = pthread_mutex_init(&alarm->mutex, null);
+        int r = pthread_mutex_init(&event->mutex, null);
         cAbort(r, "pthread_mutex_init");
 
-        r = pthread_cond_init(&alarm->cond, null);
+        r = pthread_cond_init(&event->cond, null);
         cAbort(r, "pthread_cond_init");
 
-        double fabstime = xTime() + delay;
-        alarm->abstime.tv_sec = fabstime;
-        alarm->abstime.tv_nsec = fmod(fabstime, 1.0) * 1e9;
+        event->isSet = false;
+        return event;
+}
 
-        alarm->abort = false;
+void destroyEvent(xEvent_t event)
+{
+        if (event == null)
+                return;
 
-        alarm->function = function;
-        alarm->data = data;
+        int r = pthread_mutex_destroy(&event->mutex);
+        cAbort(r, "pthread_mutex_destroy");
 
-        r = pthread_create(&alarm->thread, null, alarmThreadStart, alarm);
-        cAbort(r, "pthread_create");
+        r = pthread_cond_destroy(&event->cond);
+        cAbort(r, "pthread_cond_destroy");
 
-        return alarm;
+        free(event);
 }
 
-void clearAlarm(xAlarm_t alarm)
+void setEvent(xEvent_t event)
 {
-        if (alarm == null)
-                return;
-
-        /*
-         *  Stop alarm thread if it is still waiting
-         */
-
-        int r = pthread_mutex_lock(&alarm->mutex);
+        int r = pthread_mutex_lock(&event->mutex);
         cAbort(r, "pthread_mutex_lock");
 
-        alarm->abort = true;
-        r = pthread_cond_signal(&alarm->cond);
-        cAbort(r, "pthread_cond_signal");
+        event->isSet = true;
+        r = pthread_cond_broadcast(&event->cond);
+        cAbort(r, "pthread_cond_broadcast");
 
-        r = pthread_mutex_unlock(&alarm->mutex);
+        r = pthread_mutex_unlock(&event->mutex);
         cAbort(r, "pthread_mutex_unlock");
+}
 
-        /*
-         *  Free resources
-         */
+void resetEvent(xEvent_t event)
+{
+        int r = pthread_mutex_lock(&event->mutex);
+        cAbort(r, "pthread_mutex_lock");
 
-        r = pthread_join(alarm->thread, null);
-        cAbort(r, "pthread_join");
+        event->isSet = false;
 
-        r = pthread_mutex_destroy(&alarm->mutex);
-        cAbort(r, "pthread_mutex_destroy");
+        r = pthread_mutex_unlock(&event->mutex);
+        cAbort(r, "pthread_mutex_unlock");
+}
 
-        r = pthread_cond_destroy(&alarm->cond);
-        cAbort(r, "pthread_cond_destroy");
+void waitEvent(xEvent_t event)
+{
+        int r = pthread_mutex_lock(&event->mutex);
+        cAbort(r, "pthread_mutex_lock");
 
-        free(alarm);
+        while (!event->isSet) {
+                r = pthread_cond_wait(&event->cond, &event->mutex);
+                cAbort(r, "pthread_cond_wait");
+        }
+
+        r = pthread_mutex_unlock(&event->mutex);
+        cAbort(r, "pthread_mutex_unlock");
 }
 #endif
 
@@ -154,6 +154,7 @@ void listPrintf(charList *list, const char *format, ...);
  +----------------------------------------------------------------------*/
 
 double xTime(void);
+double xThreadTime(void);
 char *stringCopy(char *s, const char *t);
 int compareInt(const void *ap, const void *bp);
 int readLine(void *fp, charList *lineBuffer);
@@ -191,13 +192,25 @@ xThread_t createThread(thread_fn *function, void *data);
 void joinThread(xThread_t thread);
 
 /*
- *  An alarm is a thread that runs its main function with a delay,
- *  and which can be safely aborted while it is waiting to run.
+ *  An alarm runs its function with a delay on a shared timer thread,
+ *  and can be safely aborted while it is waiting to run. After clearAlarm
+ *  returns the function is not running and will not run anymore.
  */
 typedef struct alarmHandle *xAlarm_t;
 xAlarm_t setAlarm(double delay, thread_fn *function, void *data);
 void clearAlarm(xAlarm_t alarm);
 
+/*
+ *  An event is a flag that threads can block on until another thread
+ *  sets it. It stays set until it is explicitly reset.
+ */
+typedef struct eventHandle *xEvent_t;
+xEvent_t createEvent(void);
+void destroyEvent(xEvent_t event);
+void setEvent(xEvent_t event);
+void resetEvent(xEvent_t event);
+void waitEvent(xEvent_t event);
+
 /*----------------------------------------------------------------------+
  |                                                                      |
  +----------------------------------------------------------------------*/
@@ -0,0 +1,842 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      egt.c -- endgame tables for three and four men                  |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015-2016, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Please read the enclosed file `LICENSE' or retrieve this document
+ *  from https://marcelk.net/floyd/LICENSE for terms and conditions.
+ */
+
+/*
+ *  Distance-to-mate tables generated by retrograde analysis. The mates
+ *  are found first. From there positions are resolved one ply at a time
+ *  by un-making moves of the positions that were resolved in the ply
+ *  before: a predecessor of a loss is a win, and a predecessor becomes
+ *  a loss once all its successors are known wins. Captures and
+ *  promotions leave the table. They take their value from the table
+ *  they convert into, which is therefore generated first.
+ *
+ *  Pawnless tables use all 8 board symmetries, tables with pawns only
+ *  the left-right mirror. Castling and en passant are not modelled,
+ *  so tables with pawns of both colours (KPKP) are not probed: a double
+ *  push would get the value of a position without the capture reply.
+ */
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// C standard
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// C extension
+#include "cplus.h"
+
+// Own interface
+#include "Board.h"
+#include "egt.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+enum { N = a2-a1, E = b1-a1 }; // Derived geometry
+
+enum {
+        maxMen = 4,
+        maxTables = 32,
+        maxEgtMoves = 80,
+        drawEscape = 255, // In exitLoss: some capture or promotion draws
+};
+
+#define pieceType(piece) ((piece) >= blackKing ? (piece) - blackKing + whiteKing : (piece))
+#define flipColor(piece) ((piece) >= blackKing ? (piece) - blackKing + whiteKing : (piece) - whiteKing + blackKing)
+#define isPawn(piece)    (pieceType(piece) == whitePawn)
+#define pawnCode(square) (file(square) * 6 + rank(square) - rank2)
+#define pawnSquare(code) square((code) / 6, (code) % 6 + rank2)
+#define flipRank(sq)     ((sq) ^ square(fileA, rank8))
+#define sign(x)          (((x) > 0) - ((x) < 0))
+
+// Table values are 0 for draws and 1 + plies to mate otherwise
+#define isWinValue(value)  ((value) > 0 && ((value) & 1) == 0)
+#define isLossValue(value) (((value) & 1) == 1)
+
+struct egtTable {
+        char name[maxMen + 1];  // Such as "KQKR", stronger side first
+        int nrMen;
+        int pieces[maxMen];     // Kings first, then the other men in name order
+        bool hasPawns;
+        bool probe;             // Covered by egtProbe and kept in memory
+        long size;              // Positions per side to move
+        unsigned char *dtm[2];  // Table values per side to move
+};
+
+struct egtMove {
+        int man, to, victim, promotion;
+};
+
+// Set of table indices for removing duplicates, emptied by taking a new stamp
+struct indexSet {
+        unsigned stamp;
+        struct { unsigned stamp; long ix; } slots[256];
+};
+
+/*----------------------------------------------------------------------+
+ |      Data                                                            |
+ +----------------------------------------------------------------------*/
+
+static const char pieceLetters[] = "?KQRBNP";
+
+static const char *probedTables[] = {
+        "KQK", "KRK", "KPK", "KBNK", "KQKR", "KRKP" // Not KPKP: see above
+};
+
+static const int directions[8][2] = { // file, rank: rook first, then bishop
+        {0,1}, {1,0}, {0,-1}, {-1,0}, {1,1}, {1,-1}, {-1,-1}, {-1,1}
+};
+
+static const int jumps[8][2] = {
+        {1,2}, {2,1}, {2,-1}, {1,-2}, {-1,-2}, {-2,-1}, {-2,1}, {-1,2}
+};
+
+static struct egtTable tables[maxTables];
+static int nrTables;
+
+static signed char kingCode[2][boardSize]; // [hasPawns][square] (-1 if not canonical)
+static signed char kingSquare[2][32];
+static signed char symmetric[8][boardSize];
+
+static char cachePath[256];
+
+static bool started; // egtStart has been called
+static bool tablesReady; // Published by the generator thread when it is done (release/acquire)
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+static struct egtTable *loadTable(const char *name);
+
+/*----------------------------------------------------------------------+
+ |      Indexing                                                        |
+ +----------------------------------------------------------------------*/
+
+// The white king is kept on a1-d1-d4 without pawns, or on files a-d with pawns
+static void initSymmetry(void)
+{
+        int n[2] = { 0, 0 };
+        for (int square=0; square<boardSize; square++) {
+                for (int symmetry=0; symmetry<8; symmetry++) {
+                        int image = square;
+                        if (symmetry & 1) image ^= square(fileH, rank1); // left-right
+                        if (symmetry & 2) image ^= square(fileA, rank8); // top-bottom
+                        if (symmetry & 4) image = square(rank(image), file(image)); // diagonal
+                        symmetric[symmetry][square] = image;
+                }
+
+                kingCode[0][square] = kingCode[1][square] = -1;
+                if (file(square) > fileD)
+                        continue;
+                if (rank(square) <= file(square)) {
+                        kingSquare[0][n[0]] = square;
+                        kingCode[0][square] = n[0]++;
+                }
+                kingSquare[1][n[1]] = square;
+                kingCode[1][square] = n[1]++;
+        }
+}
+
+static long rawIndex(const struct egtTable *t, const int sq[], int symmetry)
+{
+        long ix = kingCode[t->hasPawns][symmetric[symmetry][sq[0]]];
+        for (int i=1; i<t->nrMen; i++) {
+                int square = symmetric[symmetry][sq[i]];
+                ix = isPawn(t->pieces[i]) ? ix * 48 + pawnCode(square) : ix * 64 + square;
+        }
+        return ix;
+}
+
+// Index of the position, the same for all its symmetric images
+static long positionIndex(const struct egtTable *t, const int sq[])
+{
+        int symmetry = (file(sq[0]) > fileD) ? 1 : 0;
+        if (t->hasPawns)
+                return rawIndex(t, sq, symmetry);
+
+        if (rank(sq[0]) > rank4)
+                symmetry |= 2;
+        int wKing = symmetric[symmetry][sq[0]];
+        if (rank(wKing) > file(wKing))
+                symmetry |= 4;
+        long ix = rawIndex(t, sq, symmetry);
+        if (rank(wKing) == file(wKing))
+                ix = min(ix, rawIndex(t, sq, symmetry | 4));
+        return ix;
+}
+
+static void decodeIndex(const struct egtTable *t, long ix, int sq[])
+{
+        for (int i=t->nrMen-1; i>=1; i--)
+                if (isPawn(t->pieces[i])) {
+                        sq[i] = pawnSquare(ix % 48);
+                        ix /= 48;
+                } else {
+                        sq[i] = ix % 64;
+                        ix /= 64;
+                }
+        sq[0] = kingSquare[t->hasPawns][ix];
+}
+
+// Positions with men on the same square or a symmetric twin are skipped
+static bool isCanonical(const struct egtTable *t, long ix, const int sq[])
+{
+        for (int i=1; i<t->nrMen; i++)
+                for (int j=0; j<i; j++)
+                        if (sq[i] == sq[j])
+                                return false;
+        return positionIndex(t, sq) == ix;
+}
+
+/*----------------------------------------------------------------------+
+ |      Material                                                        |
+ +----------------------------------------------------------------------*/
+
+// Table name for a set of men. Returns true if the colors must be flipped
+static bool materialName(char name[], const int pieces[], int nrMen)
+{
+        int types[2][maxMen], len[2] = { 0, 0 };
+        for (int i=0; i<nrMen; i++) {
+                int side = pieceColor(pieces[i]);
+                int j = len[side]++;
+                for (; j>0 && types[side][j-1] > pieceType(pieces[i]); j--)
+                        types[side][j] = types[side][j-1];
+                types[side][j] = pieceType(pieces[i]);
+        }
+
+        // The stronger side comes first
+        int cmp = 0;
+        for (int i=0; cmp==0 && i<max(len[white], len[black]); i++)
+                cmp = (i >= len[white]) ? -1
+                    : (i >= len[black]) ? 1
+                    : types[black][i] - types[white][i];
+        int first = (cmp < 0) ? black : white;
+
+        int n = 0;
+        for (int i=0; i<len[first]; i++)
+                name[n++] = pieceLetters[types[first][i]];
+        for (int i=0; i<len[other(first)]; i++)
+                name[n++] = pieceLetters[types[other(first)][i]];
+        name[n] = '\0';
+        return first == black;
+}
+
+static bool isDrawnMaterial(const char *name)
+{
+        return !strcmp(name, "KK") || !strcmp(name, "KBK") || !strcmp(name, "KNK");
+}
+
+static struct egtTable *findTable(const char *name)
+{
+        for (int i=0; i<nrTables; i++)
+                if (!strcmp(tables[i].name, name))
+                        return &tables[i];
+
+        if (nrTables == 0)
+                initSymmetry();
+        if (nrTables == maxTables)
+                xAbort(ENOMEM, "findTable");
+
+        struct egtTable *t = &tables[nrTables++];
+        strcpy(t->name, name);
+        t->nrMen = 2;
+        int side = white;
+        for (int i=0; name[i]; i++) {
+                int type = strchr(pieceLetters, name[i]) - pieceLetters;
+                if (type == whiteKing) {
+                        side = (i == 0) ? white : black;
+                        t->pieces[side] = (side == white) ? whiteKing : blackKing;
+                } else {
+                        t->pieces[t->nrMen++] = (side == white) ? type : flipColor(type);
+                        t->hasPawns |= (type == whitePawn);
+                }
+        }
+
+        t->size = t->hasPawns ? 32 : 10;
+        for (int i=1; i<t->nrMen; i++)
+                t->size *= isPawn(t->pieces[i]) ? 48 : 64;
+
+        for (int i=0; i<arrayLen(probedTables); i++)
+                t->probe |= !strcmp(name, probedTables[i]);
+        return t;
+}
+
+// Look up a position, given as a list of men, in the table for its material
+static int probeMen(const int pieces[], const int squares[], int nrMen, int side)
+{
+        char name[maxMen + 1];
+        bool flip = materialName(name, pieces, nrMen);
+        if (isDrawnMaterial(name))
+                return 0;
+
+        struct egtTable *t = loadTable(name);
+        bool used[maxMen] = { false };
+        int sq[maxMen];
+        for (int j=0; j<t->nrMen; j++)
+                for (int i=0; i<nrMen; i++) {
+                        int piece = flip ? flipColor(pieces[i]) : pieces[i];
+                        if (!used[i] && piece == t->pieces[j]) {
+                                used[i] = true;
+                                sq[j] = flip ? flipRank(squares[i]) : squares[i];
+                                break;
+                        }
+                }
+
+        return t->dtm[flip ? other(side) : side][positionIndex(t, sq)];
+}
+
+/*----------------------------------------------------------------------+
+ |      Move generation                                                 |
+ +----------------------------------------------------------------------*/
+
+// Occupancy board holding man numbers, or -1 for empty squares
+static void placeMen(const struct egtTable *t, const int sq[], signed char occ[])
+{
+        memset(occ, -1, boardSize);
+        for (int i=0; i<t->nrMen; i++)
+                if (sq[i] >= 0)
+                        occ[sq[i]] = i;
+}
+
+static bool isAttacked(const struct egtTable *t, const int sq[], const signed char occ[],
+        int target, int side)
+{
+        for (int i=0; i<t->nrMen; i++) {
+                if (sq[i] < 0 || pieceColor(t->pieces[i]) != side)
+                        continue;
+
+                int df = file(target) - file(sq[i]), dr = rank(target) - rank(sq[i]);
+                bool onLine;
+                switch (pieceType(t->pieces[i])) {
+                case whiteKing:
+                        if (max(abs(df), abs(dr)) == 1) return true;
+                        continue;
+                case whiteKnight:
+                        if (abs(df * dr) == 2) return true;
+                        continue;
+                case whitePawn:
+                        if (abs(df) == 1 && dr == (side == white ? 1 : -1)) return true;
+                        continue;
+                case whiteBishop:
+                        onLine = abs(df) == abs(dr);
+                        break;
+                case whiteRook:
+                        onLine = !df || !dr;
+                        break;
+                default:
+                        onLine = abs(df) == abs(dr) || !df || !dr;
+                        break;
+                }
+                if (!onLine || (!df && !dr))
+                        continue;
+
+                int step = sign(df) * E + sign(dr) * N;
+                int square = sq[i] + step;
+                while (square != target && occ[square] < 0)
+                        square += step;
+                if (square == target)
+                        return true;
+        }
+        return false;
+}
+
+// Destinations of a piece, up to and including the first occupied square
+static int pieceTargets(int type, int from, const signed char occ[], int targets[])
+{
+        const int (*d)[2] = (type == whiteKnight) ? jumps : directions;
+        int first = (type == whiteBishop) ? 4 : 0;
+        int last = (type == whiteRook) ? 4 : 8;
+        bool slides = (type != whiteKing && type != whiteKnight);
+
+        int n = 0;
+        for (int i=first; i<last; i++) {
+                int f = file(from), r = rank(from);
+                for (;;) {
+                        f += d[i][0];
+                        r += d[i][1];
+                        if (!inRange(f, fileA, fileH) || !inRange(r, rank1, rank8))
+                                break;
+                        targets[n++] = square(f, r);
+                        if (!slides || occ[square(f, r)] >= 0)
+                                break;
+                }
+        }
+        return n;
+}
+
+static int generateEgtMoves(const struct egtTable *t, const int sq[], const signed char occ[],
+        int side, struct egtMove moves[])
+{
+        int n = 0;
+        for (int i=0; i<t->nrMen; i++) {
+                int piece = t->pieces[i];
+                if (pieceColor(piece) != side)
+                        continue;
+
+                if (!isPawn(piece)) {
+                        int targets[28];
+                        int nrTargets = pieceTargets(pieceType(piece), sq[i], occ, targets);
+                        for (int j=0; j<nrTargets; j++) {
+                                int victim = occ[targets[j]];
+                                if (victim < 0 || pieceColor(t->pieces[victim]) != side)
+                                        moves[n++] = (struct egtMove) { i, targets[j], victim, 0 };
+                        }
+                        continue;
+                }
+
+                int up = (side == white) ? N : -N;
+                int to[4], victim[4], nrTo = 0;
+                if (occ[sq[i]+up] < 0) {
+                        to[nrTo] = sq[i] + up, victim[nrTo++] = -1;
+                        if (rank(sq[i]) == (side == white ? rank2 : rank7) && occ[sq[i]+up+up] < 0)
+                                to[nrTo] = sq[i] + up + up, victim[nrTo++] = -1;
+                }
+                for (int dx=-E; dx<=E; dx+=2*E) {
+                        if (!inRange(file(sq[i]) + sign(dx), fileA, fileH))
+                                continue;
+                        int v = occ[sq[i]+up+dx];
+                        if (v >= 0 && pieceColor(t->pieces[v]) != side)
+                                to[nrTo] = sq[i] + up + dx, victim[nrTo++] = v;
+                }
+                for (int j=0; j<nrTo; j++) {
+                        if (rank(to[j]) == rank1 || rank(to[j]) == rank8)
+                                for (int promo=whiteQueen; promo<=whiteKnight; promo++)
+                                        moves[n++] = (struct egtMove) { i, to[j], victim[j],
+                                                side == white ? promo : flipColor(promo) };
+                        else
+                                moves[n++] = (struct egtMove) { i, to[j], victim[j], 0 };
+                }
+        }
+        return n;
+}
+
+static void makeEgtMove(int sq[], signed char occ[], struct egtMove m)
+{
+        occ[sq[m.man]] = -1;
+        occ[m.to] = m.man;
+        sq[m.man] = m.to;
+        if (m.victim >= 0)
+                sq[m.victim] = -1;
+}
+
+static void undoEgtMove(int sq[], signed char occ[], struct egtMove m, int from)
+{
+        occ[from] = m.man;
+        occ[m.to] = m.victim;
+        sq[m.man] = from;
+        if (m.victim >= 0)
+                sq[m.victim] = m.to;
+}
+
+// Value of the position after a capture or promotion, for the opponent
+static int exitValue(const struct egtTable *t, const int sq[], struct egtMove m, int side)
+{
+        int pieces[maxMen], squares[maxMen], n = 0;
+        for (int i=0; i<t->nrMen; i++) {
+                if (i == m.victim)
+                        continue;
+                pieces[n] = (i == m.man && m.promotion) ? m.promotion : t->pieces[i];
+                squares[n++] = (i == m.man) ? m.to : sq[i];
+        }
+        return probeMen(pieces, squares, n, other(side));
+}
+
+static bool addIndex(struct indexSet *set, long ix)
+{
+        int h = (uint64_t) ix * 0x9e3779b97f4a7c15ULL >> 56;
+        for (;; h=(h+1)&255) {
+                if (set->slots[h].stamp != set->stamp) {
+                        set->slots[h].stamp = set->stamp;
+                        set->slots[h].ix = ix;
+                        return true;
+                }
+                if (set->slots[h].ix == ix)
+                        return false;
+        }
+}
+
+// Indices of the distinct positions from which `side' can have moved into this one
+static int predecessors(const struct egtTable *t, int sq[], signed char occ[], int side,
+        struct indexSet *set, long list[])
+{
+        int n = 0;
+        set->stamp++;
+        for (int i=0; i<t->nrMen; i++) {
+                int piece = t->pieces[i];
+                if (pieceColor(piece) != side)
+                        continue;
+
+                int targets[28], nrTargets = 0;
+                if (!isPawn(piece))
+                        nrTargets = pieceTargets(pieceType(piece), sq[i], occ, targets);
+                else {
+                        int down = (side == white) ? -N : N;
+                        if (rank(sq[i]+down) != rank1 && rank(sq[i]+down) != rank8 && occ[sq[i]+down] < 0) {
+                                targets[nrTargets++] = sq[i] + down;
+                                if (rank(sq[i]) == (side == white ? rank4 : rank5) && occ[sq[i]+down+down] < 0)
+                                        targets[nrTargets++] = sq[i] + down + down;
+                        }
+                }
+
+                for (int j=0; j<nrTargets; j++) {
+                        if (occ[targets[j]] >= 0)
+                                continue;
+                        struct egtMove m = { i, targets[j], -1, 0 };
+                        int from = sq[i];
+                        makeEgtMove(sq, occ, m);
+                        if (!isAttacked(t, sq, occ, sq[other(side)], side)) {
+                                long ix = positionIndex(t, sq);
+                                if (addIndex(set, ix))
+                                        list[n++] = ix;
+                        }
+                        undoEgtMove(sq, occ, m, from);
+                }
+        }
+        return n;
+}
+
+/*----------------------------------------------------------------------+
+ |      Generation                                                      |
+ +----------------------------------------------------------------------*/
+
+static void generateTable(struct egtTable *t)
+{
+        // First the tables that captures and promotions convert into
+        for (int i=2; i<t->nrMen; i++) {
+                int pieces[maxMen], n = 0;
+                for (int j=0; j<t->nrMen; j++)
+                        if (j != i)
+                                pieces[n++] = t->pieces[j];
+                char name[maxMen + 1];
+                materialName(name, pieces, n);
+                if (!isDrawnMaterial(name))
+                        loadTable(name);
+
+                if (isPawn(t->pieces[i]))
+                        for (int promo=whiteQueen; promo<=whiteKnight; promo++) {
+                                pieces[n] = pieceColor(t->pieces[i]) == white ? promo : flipColor(promo);
+                                materialName(name, pieces, n + 1);
+                                if (!isDrawnMaterial(name))
+                                        loadTable(name);
+                        }
+        }
+
+        unsigned char *count[2], *exitLoss[2];
+        struct indexSet set = { .stamp = 0 };
+        for (int side=white; side<=black; side++) {
+                t->dtm[side] = calloc(t->size, 1);
+                count[side] = calloc(t->size, 1);
+                exitLoss[side] = calloc(t->size, 1);
+                if (!t->dtm[side] || !count[side] || !exitLoss[side])
+                        xAbort(ENOMEM, "generateTable");
+        }
+
+        // Mates, conversions and the number of successors
+        int maxValue = 0;
+        for (int side=white; side<=black; side++) {
+                for (long ix=0; ix<t->size; ix++) {
+                        int sq[maxMen];
+                        signed char occ[boardSize];
+                        decodeIndex(t, ix, sq);
+                        if (!isCanonical(t, ix, sq))
+                                continue;
+                        placeMen(t, sq, occ);
+                        if (isAttacked(t, sq, occ, sq[other(side)], side))
+                                continue; // Illegal
+
+                        struct egtMove moves[maxEgtMoves];
+                        int nrMoves = generateEgtMoves(t, sq, occ, side, moves);
+                        int nrLegal = 0, nrSuccessors = 0;
+                        int win = 0, worst = 0;
+                        bool escape = false;
+
+                        // Conversions first: after a winning or drawing one the count isn't needed
+                        int nrExits = 0;
+                        for (int j=0; j<nrMoves; j++)
+                                if (moves[j].victim >= 0 || moves[j].promotion) {
+                                        struct egtMove m = moves[j];
+                                        moves[j] = moves[nrExits];
+                                        moves[nrExits++] = m;
+                                }
+
+                        // Outside check only king moves and pinned men need testing
+                        bool inCheck = isAttacked(t, sq, occ, sq[side], other(side));
+                        signed char isPinned[maxMen] = { -1, -1, -1, -1 };
+                        set.stamp++;
+
+                        for (int j=0; j<nrMoves && (j<nrExits || (!win && !escape)); j++) {
+                                struct egtMove m = moves[j];
+                                int from = sq[m.man];
+                                if (!inCheck && m.man != side && isPinned[m.man] < 0) {
+                                        occ[from] = -1;
+                                        isPinned[m.man] = isAttacked(t, sq, occ, sq[side], other(side));
+                                        occ[from] = m.man;
+                                }
+
+                                bool isLegal = !inCheck && m.man != side && !isPinned[m.man];
+                                if (!isLegal || j >= nrExits) {
+                                        makeEgtMove(sq, occ, m);
+                                        isLegal = isLegal || !isAttacked(t, sq, occ, sq[side], other(side));
+                                        if (isLegal && j >= nrExits)
+                                                nrSuccessors += addIndex(&set, positionIndex(t, sq));
+                                        undoEgtMove(sq, occ, m, from);
+                                }
+
+                                nrLegal += isLegal;
+                                if (!isLegal || j >= nrExits)
+                                        continue;
+                                int value = exitValue(t, sq, m, side);
+                                if (value == 0)
+                                        escape = true;
+                                else if (isLossValue(value))
+                                        win = win ? min(win, value + 1) : value + 1;
+                                else
+                                        worst = max(worst, value - 1);
+                        }
+
+                        if (nrLegal == 0) {
+                                if (inCheck)
+                                        t->dtm[side][ix] = 1; // Mate
+                                maxValue = max(maxValue, t->dtm[side][ix]);
+                                continue;
+                        }
+                        if (win)
+                                t->dtm[side][ix] = win;
+                        else if (!escape && nrSuccessors == 0)
+                                t->dtm[side][ix] = worst + 2;
+                        maxValue = max(maxValue, t->dtm[side][ix]);
+                        count[side][ix] = nrSuccessors;
+                        exitLoss[side][ix] = escape ? drawEscape : worst;
+                }
+        }
+
+        // Resolve one ply at a time, backwards from the positions of the previous ply
+        for (int value=1; value<=maxValue && value<254; value++) {
+                for (int side=white; side<=black; side++) {
+                        unsigned char *values = t->dtm[side], *end = values + t->size;
+                        unsigned char *p = memchr(values, value, t->size);
+                        for (; p; p = memchr(p + 1, value, end - p - 1)) {
+                                int sq[maxMen];
+                                signed char occ[boardSize];
+                                decodeIndex(t, p - values, sq);
+                                placeMen(t, sq, occ);
+
+                                long list[maxEgtMoves];
+                                int n = predecessors(t, sq, occ, other(side), &set, list);
+                                for (int j=0; j<n; j++) {
+                                        unsigned char *w = &t->dtm[other(side)][list[j]];
+                                        if (isLossValue(value)) {
+                                                if (*w == 0 || *w > value + 1)
+                                                        *w = value + 1;
+                                        } else if (exitLoss[other(side)][list[j]] != drawEscape && *w == 0
+                                                && --count[other(side)][list[j]] == 0) {
+                                                int worst = exitLoss[other(side)][list[j]];
+                                                *w = min(max(value - 1, worst) + 2, 254);
+                                        }
+                                        maxValue = max(maxValue, *w);
+                                }
+                        }
+                }
+        }
+
+        for (int side=white; side<=black; side++) {
+                free(count[side]);
+                free(exitLoss[side]);
+        }
+}
+
+/*----------------------------------------------------------------------+
+ |      Cache                                                           |
+ +----------------------------------------------------------------------*/
+
+static void cacheFileName(char fileName[], int size, const struct egtTable *t)
+{
+        snprintf(fileName, size, "%s/%s.egt", cachePath, t->name);
+}
+
+/*
+ *  Cache files hold the values of both sides, with runs of 4 or more
+ *  equal values encoded as a repeat marker, length and value.
+ */
+enum { repeatMarker = 255, minRun = 4, maxRun = 255 };
+
+static void writeTable(const struct egtTable *t)
+{
+        char fileName[sizeof cachePath + 16];
+        cacheFileName(fileName, sizeof fileName, t);
+        FILE *fp = fopen(fileName, "wb");
+        if (!fp)
+                return;
+
+        fprintf(fp, "floyd egt %s %ld\n", t->name, t->size);
+        for (int side=white; side<=black; side++)
+                for (long ix=0; ix<t->size; ) {
+                        unsigned char value = t->dtm[side][ix];
+                        int run = 1;
+                        while (run < maxRun && ix + run < t->size && t->dtm[side][ix+run] == value)
+                                run++;
+                        if (run < minRun)
+                                run = 1;
+                        else {
+                                fputc(repeatMarker, fp);
+                                fputc(run, fp);
+                        }
+                        fputc(value, fp);
+                        ix += run;
+                }
+        fclose(fp);
+}
+
+static bool readTable(struct egtTable *t)
+{
+        char fileName[sizeof cachePath + 16];
+        cacheFileName(fileName, sizeof fileName, t);
+        FILE *fp = fopen(fileName, "rb");
+        if (!fp)
+                return false;
+
+        char name[maxMen + 2];
+        long size;
+        bool ok = fscanf(fp, "floyd egt %5s %ld", name, &size) == 2
+               && fgetc(fp) == '\n'
+               && !strcmp(name, t->name) && size == t->size;
+
+        for (int side=white; side<=black && ok; side++) {
+                t->dtm[side] = malloc(t->size);
+                if (!t->dtm[side])
+                        xAbort(ENOMEM, "readTable");
+                for (long ix=0; ix<t->size && ok; ) {
+                        int run = 1, value = fgetc(fp);
+                        if (value == repeatMarker) {
+                                run = fgetc(fp);
+                                value = fgetc(fp);
+                        }
+                        ok = run >= 1 && value != EOF && ix + run <= t->size;
+                        if (ok) memset(&t->dtm[side][ix], value, run);
+                        ix += run;
+                }
+        }
+        fclose(fp);
+
+        if (!ok)
+                for (int side=white; side<=black; side++) {
+                        free(t->dtm[side]);
+                        t->dtm[side] = null;
+                }
+        return ok;
+}
+
+static struct egtTable *loadTable(const char *name)
+{
+        struct egtTable *t = findTable(name);
+        if (!t->dtm[white] && !(cachePath[0] && readTable(t))) {
+                generateTable(t);
+                if (cachePath[0])
+                        writeTable(t);
+        }
+        return t;
+}
+
+/*----------------------------------------------------------------------+
+ |      Interface                                                       |
+ +----------------------------------------------------------------------*/
+
+// Load or generate all probed tables, then release what they were made from
+static void generateAll(void *data)
+{
+        unused(data);
+        for (int i=0; i<arrayLen(probedTables); i++)
+                loadTable(probedTables[i]);
+
+        for (int i=0; i<nrTables; i++)
+                if (!tables[i].probe)
+                        for (int side=white; side<=black; side++) {
+                                free(tables[i].dtm[side]);
+                                tables[i].dtm[side] = null;
+                        }
+
+        __atomic_store_n(&tablesReady, true, __ATOMIC_RELEASE); // After the tables
+}
+
+bool egtStart(const char *path)
+{
+        if (started)
+                return !strcmp(path, cachePath);
+        if (!path[0])
+                return true; // Stay off
+        started = true;
+        snprintf(cachePath, sizeof cachePath, "%s", path);
+        createThread(generateAll, null); // Never joined: it may outlive the engine
+        return true;
+}
+
+bool egtCovers(uint64_t materialKey)
+{
+        static const int shifts[] = { // See materialKeys
+                [whiteQueen] = 32, [whiteRook] = 24, [whiteBishop] = 16,
+                [whiteKnight] = 8, [whitePawn] = 0
+        };
+
+        int pieces[maxMen] = { whiteKing, blackKing }, n = 2;
+        for (int side=white; side<=black; side++)
+                for (int type=whiteQueen; type<=whitePawn; type++) {
+                        int count = (materialKey >> (shifts[type] + 4 * side)) & 15;
+                        for (; count > 0; count--) {
+                                if (n == maxMen)
+                                        return false;
+                                pieces[n++] = (side == white) ? type : flipColor(type);
+                        }
+                }
+
+        char name[maxMen + 1];
+        materialName(name, pieces, n);
+        for (int i=0; i<arrayLen(probedTables); i++)
+                if (!strcmp(name, probedTables[i]))
+                        return true;
+        return false;
+}
+
+bool egtProbe(Board_t self, int *wdl, int *dtm)
+{
+        if (!__atomic_load_n(&tablesReady, __ATOMIC_ACQUIRE))
+                return false;
+        if (self->castleFlags || self->enPassantPawn || !egtCovers(self->materialKey))
+                return false;
+
+        int pieces[maxMen], squares[maxMen], n = 0;
+        for (int square=0; square<boardSize; square++)
+                if (self->squares[square] != empty) {
+                        pieces[n] = self->squares[square];
+                        squares[n++] = square;
+                }
+
+        int value = probeMen(pieces, squares, n, sideToMove(self));
+        *wdl = (value == 0) ? 0 : isWinValue(value) ? 1 : -1;
+        *dtm = max(value - 1, 0);
+        return true;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
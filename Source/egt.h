@@ -0,0 +1,47 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      egt.h -- endgame tables for three and four men                  |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015-2016, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Please read the enclosed file `LICENSE' or retrieve this document
+ *  from https://marcelk.net/floyd/LICENSE for terms and conditions.
+ */
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Probe the position in the distance-to-mate tables.
+ *  Returns false if the tables are not ready yet, if the material is
+ *  not covered (or the position has castling rights or an en passant
+ *  capture). Otherwise returns true, sets `*wdl' to 1, 0 or -1 for a
+ *  win, draw or loss of the side to move, and `*dtm' to the number of
+ *  plies until mate. Safe to call from any thread.
+ */
+bool egtProbe(Board_t board, int *wdl, int *dtm);
+
+/*
+ *  Start loading the tables on a background thread, from the cache
+ *  directory `path' or, if they are not there, by generating them
+ *  (about a minute) and then writing them to the cache. With an empty
+ *  path the tables stay off. Once started, the path can't change:
+ *  returns false if `path' differs from the one in use.
+ */
+bool egtStart(const char *path);
+
+/*
+ *  Return true if the probe covers this material (see materialKeys)
+ */
+bool egtCovers(uint64_t materialKey);
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
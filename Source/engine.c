@@ -46,9 +46,16 @@ void cleanupEngine(Engine_t self)
         freeList(self->board.materialHistory);
         freeList(self->board.undoStack);
         freeList(self->searchMoves);
+        for (int i=0; i<self->rootMoves.maxLen; i++)
+                freeList(self->rootMoves.v[i].pv);
+        freeList(self->rootMoves);
         freeList(self->pv);
         freeList(self->killers);
+        freeList(self->continuationKeys);
+        destroyEvent(self->ponderEnd);
+        free(self->continuationHistory);
         free(self->tt.slots);
+        free(self->mateTable.slots);
 }
 
 /*----------------------------------------------------------------------+
@@ -33,6 +33,7 @@
 #include "Engine.h"
 
 // Other modules
+#include "egt.h"
 #include "kpk.h"
 
 /*----------------------------------------------------------------------+
@@ -55,8 +56,15 @@ enum vector {
         #undef P
 };
 
+struct mSlot;
+typedef int endgameFunction(Board_t self, const struct mSlot *mSlot);
+
 struct mSlot {
         uint64_t materialKey;
+        bool inTables; // Covered by the endgame tables
+        endgameFunction *endgame; // Replaces the generic evaluation, or null
+        endgameFunction *scale;   // Scales it down (0..scaleNormal), or null
+        int strongSide;           // The side these functions evaluate for
         int wiloScore[2];
         int drawScore;
         double passerScaling[2];
@@ -98,6 +106,9 @@ struct pkSlot {
 #define allKnights (nrKnights(white) + nrKnights(black))
 #define allPawns   (nrPawns(white)   + nrPawns(black))
 
+#define materialCounts     (materialMaskPiecesAndPawns[white] | materialMaskPiecesAndPawns[black])
+#define flipCounts(key)    ((((key) & materialMaskPiecesAndPawns[white]) << 4) | (((key) >> 4) & materialMaskPiecesAndPawns[white]))
+
 #define nrMinors(side)     (nrKnights(side) + nrBishops(side))
 #define nrMajors(side)     (nrRooks(side)   + nrQueens(side))
 #define nrSliders(side)    (nrBishops(side) + nrRooks(side) + nrQueens(side))
@@ -121,6 +132,11 @@ int globalVector[] = {
 };
 bool globalVectorChanged = false; // TODO: move to Python engine object
 
+enum {
+        knownWin = 10000,  // Base score of a specialised endgame win
+        scaleNormal = 16,  // Scale factor that leaves the evaluation unchanged
+};
+
 static const int firstRank[] = { rank1, rank8 }; // white, black
 static const int pawnStep[] = { a3 - a2, a6 - a7 };
 
@@ -152,6 +168,7 @@ static struct mSlot materialTable[1L<<16]; // size is really fixed
  +----------------------------------------------------------------------*/
 
 static void evaluateMaterial(Board_t self, struct mSlot *mSlot);
+static void findEndgame(Board_t self, struct mSlot *mSlot);
 static void extractPawnStructure(Board_t self, const int v[vectorLen], struct pkSlot *pawns);
 // TODO: cleanup these function prototypes
 static void evaluatePawnFile(Board_t self, const int v[vectorLen], struct pkSlot *pawns, int file, int side, int maxPawnFromFirst[2][10][2]);
@@ -203,6 +220,26 @@ int evaluate(Board_t self)
         if (mSlot->materialKey != self->materialKey)
                 evaluateMaterial(self, mSlot);
 
+        /*--------------------------------------------------------------+
+         |      Endgame tables                                          |
+         +--------------------------------------------------------------*/
+
+        int wdl, dtm;
+        if (mSlot->inTables && egtProbe(self, &wdl, &dtm)) {
+                self->futilityMargin = 5000;
+                return (wdl > 0) ? maxDtz - dtm : (wdl < 0) ? minDtz + dtm : 0;
+        }
+
+        /*--------------------------------------------------------------+
+         |      Specialised endgames                                    |
+         +--------------------------------------------------------------*/
+
+        if (mSlot->endgame) {
+                self->futilityMargin = 5000;
+                int score = mSlot->endgame(self, mSlot);
+                return (sideToMove(self) == mSlot->strongSide) ? score : -score;
+        }
+
         int wiloScore[2]; // Accumulators
         wiloScore[white] = mSlot->wiloScore[white];
         wiloScore[black] = mSlot->wiloScore[black];
@@ -494,6 +531,14 @@ int evaluate(Board_t self)
         static const double Ci = 4.0 / M_LN10;
         int score = round(Ci * logit(P) * 1e+3);
 
+        if (mSlot->scale) { // Only ever towards a draw
+                int scale = mSlot->scale(self, mSlot);
+                if (scale == 0)
+                        return 0;
+                if ((score > 0) == (side == mSlot->strongSide))
+                        score = score * scale / scaleNormal;
+        }
+
         if (score == 0) score++; // Reserve 0 exclusively for draws
         score = min(score,  maxEval);
         score = max(score, -maxEval);
@@ -656,6 +701,8 @@ static void evaluateMaterial(Board_t self, struct mSlot *mSlot)
 
         // Wrap-up
         mSlot->drawScore = drawScore;
+        mSlot->inTables = egtCovers(self->materialKey);
+        findEndgame(self, mSlot);
         mSlot->materialKey = self->materialKey;
 }
 
@@ -1190,6 +1237,123 @@ static int evaluateKing(const int v[vectorLen], int square, int side)
         return kingScore;
 }
 
+/*----------------------------------------------------------------------+
+ |      Specialised endgames                                            |
+ +----------------------------------------------------------------------*/
+
+#define centerDistance(square) (abs(2 * file(square) - 7) + abs(2 * rank(square) - 7)) // 2..14
+#define manhattan(a, b) (abs(file(a) - file(b)) + abs(rank(a) - rank(b)))
+
+// Lone king against mating material: drive it to the edge and approach it
+static int evaluateKXK(Board_t self, const struct mSlot *mSlot)
+{
+        int side = mSlot->strongSide;
+        int king = self->sides[side].king;
+        int xking = self->sides[other(side)].king;
+
+        int score = knownWin + mSlot->wiloScore[side] - mSlot->wiloScore[other(side)]
+                  + 100 * centerDistance(xking)
+                  - 200 * kingDistance(king, xking);
+        return min(score, maxEval);
+}
+
+// KBNK: the lone king must be mated in a corner of the bishop's color
+static int evaluateKBNK(Board_t self, const struct mSlot *mSlot)
+{
+        int side = mSlot->strongSide;
+        int king = self->sides[side].king;
+        int xking = self->sides[other(side)].king;
+
+        bool dark = nrBishopsD(side) > 0;
+        int corner1 = dark ? a1 : a8;
+        int corner2 = dark ? h8 : h1;
+        int cornerDistance = min(manhattan(xking, corner1), manhattan(xking, corner2));
+
+        return knownWin + mSlot->wiloScore[side] - mSlot->wiloScore[other(side)]
+             + 200 * (14 - cornerDistance)
+             - 200 * kingDistance(king, xking);
+}
+
+// KQKP: a rook or bishop pawn on the seventh, supported by its king, often draws
+static int scaleKQKP(Board_t self, const struct mSlot *mSlot)
+{
+        int xside = other(mSlot->strongSide);
+        int pawn = squareOf(self, (xside == white) ? whitePawn : blackPawn);
+
+        int file = file(pawn);
+        bool drawishFile = file == fileA || file == fileC || file == fileF || file == fileH;
+        bool onSeventh = (rank(pawn) ^ firstRank[xside]) == rank7;
+
+        if (drawishFile && onSeventh && kingDistance(self->sides[xside].king, pawn) == 0)
+                return scaleNormal / 4;
+        return scaleNormal;
+}
+
+// Bishop and rook pawns: a draw if the bishop can't drive the lone king from the corner
+static int scaleKBPsK(Board_t self, const struct mSlot *mSlot)
+{
+        int side = mSlot->strongSide;
+        int pawn = (side == white) ? whitePawn : blackPawn;
+
+        int pawnFiles = 0;
+        for (int square=0; square<boardSize; square++)
+                if (self->squares[square] == pawn)
+                        pawnFiles |= 1 << file(square);
+        if (pawnFiles != 1 << fileA && pawnFiles != 1 << fileH)
+                return scaleNormal;
+
+        int queeningSquare = square((pawnFiles == 1 << fileA) ? fileA : fileH, firstRank[other(side)]);
+        bool darkCorner = squareColor(queeningSquare) == 1;
+        bool wrongBishop = (darkCorner ? nrBishopsD(side) : nrBishopsL(side)) == 0;
+
+        if (wrongBishop && kingDistance(self->sides[other(side)].king, queeningSquare) <= 0)
+                return 0;
+        return scaleNormal;
+}
+
+/*
+ *  Registry of specialised endgames, by piece counts (see materialKeys)
+ *  with white as the strong side
+ */
+static const struct {
+        uint64_t key;
+        endgameFunction *endgame;
+        endgameFunction *scale;
+} endgames[] = {
+        { 0x0000010100ull, evaluateKBNK, null }, // KBNK
+        { 0x0100000010ull, null, scaleKQKP },    // KQKP
+};
+
+static void findEndgame(Board_t self, struct mSlot *mSlot)
+{
+        mSlot->endgame = null;
+        mSlot->scale = null;
+
+        uint64_t key = self->materialKey & materialCounts;
+        for (int i=0; i<arrayLen(endgames); i++)
+                for (int side=white; side<=black; side++)
+                        if (key == ((side == white) ? endgames[i].key : flipCounts(endgames[i].key))) {
+                                mSlot->endgame = endgames[i].endgame;
+                                mSlot->scale = endgames[i].scale;
+                                mSlot->strongSide = side;
+                                return;
+                        }
+
+        // Lone king against anything else
+        for (int side=white; side<=black; side++) {
+                if ((self->materialKey & materialMaskPiecesAndPawns[other(side)]) != 0)
+                        continue;
+                mSlot->strongSide = side;
+
+                if (nrMajors(side) > 0
+                 || (nrBishopsL(side) > 0 && nrBishopsD(side) > 0)
+                 || (nrBishops(side) > 0 && nrKnights(side) > 0))
+                        mSlot->endgame = evaluateKXK;
+                else if (nrBishops(side) > 0 && nrKnights(side) == 0 && nrPawns(side) > 0)
+                        mSlot->scale = scaleKBPsK;
+        }
+}
+
 /*----------------------------------------------------------------------+
  |      sigmoid and logit                                               |
  +----------------------------------------------------------------------*/
@@ -38,6 +38,7 @@
 #include "Board.h"
 #include "Engine.h"
 
+#include "kpk.h"
 #include "uci.h"
 
 int main(void)
@@ -48,6 +49,8 @@ int main(void)
                "\n"
                "Type \"help\" for more information, or \"quit\" to leave.\n\n");
 
+        kpkGenerate(); // Before any search thread can probe
+
         struct Engine engine;
         initEngine(&engine);
 
@@ -51,6 +51,7 @@
 // Other modules
 #include "Board.h"
 #include "Engine.h"
+#include "kpk.h"
 #include "uci.h"
 
 /*----------------------------------------------------------------------+
@@ -140,13 +141,55 @@ floydmodule_setCoefficient(PyObject *self, PyObject *args)
  +----------------------------------------------------------------------*/
 
 PyDoc_STRVAR(search_doc,
-        "search(fen, depth=" quote2(maxDepth) ", movetime=0.0, info=None) -> score, move\n"
+        "search(fen, depth=" quote2(maxDepth) ", movetime=0.0, info=None, multipv=1, mate=0, pds=0) -> score, move[, lines]\n"
+        "With multipv > 1, also return the best lines as a list of (score, [move, ...])\n"
+        "With mate != 0, first try to prove a mate in that many moves (or being mated\n"
+        "when negative) with proof-number search\n"
+        "With pds != 0, use probability density search instead of PVS (depth is then\n"
+        "in units of about one ply)\n"
         "Valid options for `info' are:\n"
         "       None    : No info\n"
         "       'uci'   : Write UCI info lines to stdout\n"
 //      "       'xboard': Write XBoard info lines to stdout\n"
 );
 
+// List the MultiPV lines: the main line first, then the other root moves that have one
+static PyObject *multiPvLines(Engine_t engine)
+{
+        PyObject *lines = PyList_New(0);
+        if (!lines)
+                return null;
+
+        for (int i=0; i<engine->rootMoves.len && PyList_GET_SIZE(lines)<engine->multiPv; i++) {
+                int score = engine->rootMoves.v[i].score;
+                intList *pv = &engine->rootMoves.v[i].pv;
+                if (i == 0)
+                        score = engine->score, pv = &engine->pv;
+                else if (pv->len == 0)
+                        continue;
+
+                PyObject *moves = PyList_New(pv->len);
+                if (!moves) {
+                        Py_DECREF(lines);
+                        return null;
+                }
+                for (int j=0; j<pv->len; j++) {
+                        char moveString[maxMoveSize];
+                        moveToUci(moveString, pv->v[j]);
+                        PyList_SET_ITEM(moves, j, PyString_FromString(moveString));
+                }
+
+                PyObject *line = Py_BuildValue("(dN)", score / 1000.0, moves);
+                if (!line || PyList_Append(lines, line)) {
+                        Py_XDECREF(line);
+                        Py_DECREF(lines);
+                        return null;
+                }
+                Py_DECREF(line);
+        }
+        return lines;
+}
+
 static PyObject *
 floydmodule_search(PyObject *self, PyObject *args, PyObject *keywords)
 {
@@ -155,11 +198,14 @@ floydmodule_search(PyObject *self, PyObject *args, PyObject *keywords)
         int depth = maxDepth;
         double movetime = 0.0;
         char *info = null;
+        int multipv = 1;
+        int mate = 0;
+        int pds = 0;
 
-        static char *keywordList[] = { "fen", "depth", "movetime", "info", null };
+        static char *keywordList[] = { "fen", "depth", "movetime", "info", "multipv", "mate", "pds", null };
 
-        if (!PyArg_ParseTupleAndKeywords(args, keywords, "s|idz:search", keywordList,
-                &fen, &depth, &movetime, &info))
+        if (!PyArg_ParseTupleAndKeywords(args, keywords, "s|idziii:search", keywordList,
+                &fen, &depth, &movetime, &info, &multipv, &mate, &pds))
                 return null;
 
         struct Engine engine;
@@ -179,6 +225,9 @@ floydmodule_search(PyObject *self, PyObject *args, PyObject *keywords)
         if (movetime < 0.0)
                 return PyErr_Format(PyExc_ValueError, "Invalid movetime (%g)", movetime);
 
+        if (multipv < 1 || multipv > maxMoves)
+                return PyErr_Format(PyExc_ValueError, "Invalid multipv (%d)", multipv);
+
         searchInfo_fn *infoFunction = noInfoFunction;
         void *infoData = &engine;
         if (info != null) {
@@ -191,23 +240,44 @@ floydmodule_search(PyObject *self, PyObject *args, PyObject *keywords)
         engine.target.depth = depth;
         engine.target.nodeCount = maxLongLong;
         engine.target.scores = (intPair) {{ -maxInt, maxInt }};;
+        if (mate != 0) // As for UCI "go mate"
+                engine.target.scores = (intPair) {{ minMate - 2 * min(0, mate), maxMate - 2 * max(0, mate) }};
+        engine.target.mate = mate;
         engine.target.time = 0.0;
         engine.target.maxTime = movetime;
         engine.pondering = false;
+        engine.multiPv = multipv;
+        engine.pds = (pds != 0);
         engine.infoFunction = infoFunction;
         engine.infoData = infoData;
 
         if (globalVectorChanged)
                 resetEvaluate();
-        rootSearch(&engine);
+        if (mate != 0)
+                mateSearch(&engine);
+        else
+                rootSearch(&engine);
+
+        PyObject *lines = null;
+        if (multipv > 1 && !PyErr_Occurred())
+                lines = multiPvLines(&engine);
         cleanupEngine(&engine);
 
-        if (PyErr_Occurred())
+        if (PyErr_Occurred()) {
+                Py_XDECREF(lines);
+                return null;
+        }
+
+        PyObject *result = PyTuple_New(lines ? 3 : 2);
+        if (!result) {
+                Py_XDECREF(lines);
                 return null;
+        }
 
-        PyObject *result = PyTuple_New(2);
-        if (!result)
+        if (lines && PyTuple_SetItem(result, 2, lines)) {
+                Py_DECREF(result);
                 return null;
+        }
 
         if (PyTuple_SetItem(result, 0, PyFloat_FromDouble(engine.score / 1000.0))) {
                 Py_DECREF(result);
@@ -259,6 +329,8 @@ initfloyd(void)
         PyObject *versionString = PyString_FromString(quote2(floydVersion));
         if (versionString)
                 PyModule_AddObject(module, "__version__", versionString);
+
+        kpkGenerate();
 }
 
 /*----------------------------------------------------------------------+
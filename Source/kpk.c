@@ -39,6 +39,8 @@
  +----------------------------------------------------------------------*/
 
 // C standard
+#include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -84,6 +86,7 @@ enum { white, black };
  +----------------------------------------------------------------------*/
 
 static uint64_t kpkTable[2][64*32];
+static bool kpkGenerated;
 static const int kingSteps[] = { N+W, N, N+E, W, E, S+W, S, S+E };
 
 /*----------------------------------------------------------------------+
@@ -92,7 +95,7 @@ static const int kingSteps[] = { N+W, N, N+E, W, E, S+W, S, S+E };
 
 int kpkProbe(int side, int wKing, int wPawn, int bKing)
 {
-        if (!kpkTable[0][1]) kpkGenerate();
+        assert(kpkGenerated);
 
         if (file(wPawn) >= 4) {
                 wKing ^= square(7, 0);
@@ -106,6 +109,9 @@ int kpkProbe(int side, int wKing, int wPawn, int bKing)
 
 int kpkGenerate(void)
 {
+        if (kpkGenerated)
+                return sizeof kpkTable;
+
         uint64_t valid[ arrayLen(kpkTable[0]) ];
 
         for (int ix=0; ix<arrayLen(kpkTable[0]); ix++) {
@@ -166,6 +172,7 @@ int kpkGenerate(void)
                 }
         } while (changed);
 
+        kpkGenerated = true;
         return sizeof kpkTable;
 }
 
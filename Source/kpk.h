@@ -15,14 +15,15 @@
  *
  *  The position must be legal for meaningful results.
  *  `side' is 0 for white to move and 1 for black to move.
- * 
- *  If the table has not been generated yet, this will be
- *  done automatically at the first invocation.
+ *
+ *  The table must have been generated with kpkGenerate() first.
+ *  Probing is then safe from any number of threads.
  */
 int kpkProbe(int side, int wKing, int wPawn, int bKing);
 
 /*
- *  Explicitly generate the KPK table.
+ *  Generate the KPK table, once. Call this at program startup,
+ *  before any thread can probe. Later calls return immediately.
  *  Returns the memory size for info.
  *  This can take up to 2 milliseconds on a 2.6GHz Intel i7.
  */
@@ -0,0 +1,375 @@
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ |      mate.c -- depth-first proof-number search for `go mate'         |
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Copyright (C) 2015-2016, Marcel van Kervinck
+ *  All rights reserved
+ *
+ *  Please read the enclosed file `LICENSE' or retrieve this document
+ *  from https://marcelk.net/floyd/LICENSE for terms and conditions.
+ */
+
+/*
+ *  The attacker is the side that should give mate, the defender tries
+ *  to survive the given number of plies. Every node has a proof number
+ *  (how many leaves must still be proven for the attacker) and a
+ *  disproof number (same for the defender). The search descends into
+ *  the most-proving child until its numbers reach the thresholds handed
+ *  down from the parent (Nagai's df-pn). Results live in a node table
+ *  of its own, so the regular transposition table is left untouched.
+ */
+
+/*----------------------------------------------------------------------+
+ |      Includes                                                        |
+ +----------------------------------------------------------------------*/
+
+// Python API (must come first)
+#ifdef PYTHON_MODULE
+ #include "Python.h"
+#else
+ #define PyErr_CheckSignals() 0 // Stub
+#endif
+
+// C standard
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// C extension
+#include "cplus.h"
+
+// Own interface
+#include "Board.h"
+#include "Engine.h"
+
+/*----------------------------------------------------------------------+
+ |      Definitions                                                     |
+ +----------------------------------------------------------------------*/
+
+#define pnInfinity 1000000000U
+#define mateTableBits 20
+#define mateBucketSize 4
+
+struct mateSlot {
+        uint64_t hash;          // position and attacker
+        unsigned int pn, dn;    // proof and disproof number
+        short plies;            // mate distance when proven, else plies to go
+        unsigned short move;    // proving move, or the longest defence
+        unsigned int work;      // nodes spent, for replacement
+};
+
+struct mateNode {
+        unsigned int pn, dn;
+        int plies;
+        int move;
+};
+
+// Which side gives mate is part of the position for the table
+static const uint64_t attackerKeys[2] = { 0, 0x9e3779b97f4a7c15ULL };
+
+/*----------------------------------------------------------------------+
+ |      Functions                                                       |
+ +----------------------------------------------------------------------*/
+
+static struct mateNode proofSearch(Engine_t self, int attacker, int plies,
+        unsigned int thPn, unsigned int thDn);
+static int expandNode(Engine_t self, int attacker, int plies, int moves[], struct mateNode children[]);
+static struct mateNode mateRead(Engine_t self, int attacker, int plies, unsigned int pn);
+static void mateWrite(Engine_t self, int attacker, int plies, struct mateNode node, long long work);
+static int proofLine(Engine_t self, int attacker, int plies);
+static bool mateAborted(Engine_t self);
+
+static inline unsigned int pnAdd(unsigned int a, unsigned int b)
+{
+        return min((unsigned long long) a + b, pnInfinity);
+}
+
+/*----------------------------------------------------------------------+
+ |      mateSearch                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Find the shortest mate (target.mate > 0) or the longest defence
+ *  against a mate (target.mate < 0) within the given number of moves,
+ *  by deepening one move at a time. Fall back to rootSearch with the
+ *  remaining limits when there is no proof.
+ */
+void mateSearch(Engine_t self)
+{
+        double startTime = xTime();
+        self->nodeCount = 0;
+        self->rootPlyNumber = board(self)->plyNumber;
+        self->rootMoves.len = 0; // No MultiPV lines
+        self->pv.len = 0;
+        self->bestMove = self->ponderMove = 0;
+
+        if (!self->mateTable.slots) { // Kept between searches: proofs stay valid
+                self->mateTable.slots = calloc(1 << mateTableBits, sizeof self->mateTable.slots[0]);
+                if (!self->mateTable.slots)
+                        xAbort(errno, "calloc");
+        }
+
+        if (self->target.maxTime > 0.0 && !self->pondering)
+                self->alarmHandle = setAlarm(self->target.maxTime, abortSearch, self);
+
+        int side = sideToMove(board(self));
+        int attacker = (self->target.mate > 0) ? side : other(side);
+        int maxN = min(abs(self->target.mate), maxDepth / 2); // Bounds the recursion
+        bool solved = false;
+
+        for (int n=1; n<=maxN && !solved && !mateAborted(self); n++) {
+                int plies = (self->target.mate > 0) ? 2 * n - 1 : 2 * n;
+                struct mateNode root = proofSearch(self, attacker, plies, pnInfinity, pnInfinity);
+                self->depth = plies;
+                self->seconds = xTime() - startTime;
+                if (root.pn == 0) {
+                        solved = true;
+                        self->score = (attacker == side) ? maxMate - root.plies : minMate + root.plies;
+                        proofLine(self, attacker, root.plies);
+                        self->bestMove = (self->pv.len > 0) ? self->pv.v[0] : 0;
+                        self->ponderMove = (self->pv.len > 1) ? self->pv.v[1] : 0;
+                        self->infoFunction(self->infoData);
+                }
+        }
+
+        clearAlarm(self->alarmHandle);
+        self->alarmHandle = null;
+
+        if (!solved) {
+                if (self->target.maxTime > 0.0) // What is left of it
+                        self->target.maxTime = max(self->target.maxTime - (xTime() - startTime), 1e-3);
+                rootSearch(self);
+        }
+}
+
+/*----------------------------------------------------------------------+
+ |      proofSearch                                                     |
+ +----------------------------------------------------------------------*/
+
+static struct mateNode proofSearch(Engine_t self, int attacker, int plies,
+        unsigned int thPn, unsigned int thDn)
+{
+        long long startCount = self->nodeCount;
+        int moves[maxMoves];
+        struct mateNode children[maxMoves];
+        bool isAttacker = sideToMove(board(self)) == attacker;
+        int nrMoves = expandNode(self, attacker, plies, moves, children);
+
+        struct mateNode node;
+        for (;;) {
+                // Combine the children: OR for the attacker, AND for the defender
+                node = (struct mateNode) { .pn = isAttacker ? pnInfinity : 0,
+                                           .dn = isAttacker ? 0 : pnInfinity,
+                                           .plies = plies };
+                int best = -1;
+                unsigned int second = pnInfinity;
+                for (int i=0; i<nrMoves; i++) {
+                        unsigned int own = isAttacker ? children[i].pn : children[i].dn;
+                        if (isAttacker) {
+                                node.pn = min(node.pn, children[i].pn);
+                                node.dn = pnAdd(node.dn, children[i].dn);
+                        } else {
+                                node.pn = pnAdd(node.pn, children[i].pn);
+                                node.dn = min(node.dn, children[i].dn);
+                        }
+                        if (best < 0 || own < (isAttacker ? children[best].pn : children[best].dn)) {
+                                if (best >= 0)
+                                        second = isAttacker ? children[best].pn : children[best].dn;
+                                best = i;
+                        } else
+                                second = min(second, own);
+                }
+
+                if (nrMoves == 0) { // Mate, stalemate or no checks left
+                        node = children[0];
+                        break;
+                }
+
+                if (node.pn == 0) { // Shortest proof for the attacker, longest for the defender
+                        int j = -1;
+                        for (int i=0; i<nrMoves; i++)
+                                if (children[i].pn == 0 && (j < 0
+                                 || (isAttacker ? children[i].plies < children[j].plies
+                                                : children[i].plies > children[j].plies)))
+                                        j = i;
+                        node.plies = children[j].plies + 1;
+                        node.move = moves[j];
+                }
+
+                if (node.pn >= thPn || node.dn >= thDn || mateAborted(self))
+                        break;
+
+                // Descend into the most-proving child
+                unsigned int childThPn, childThDn;
+                struct mateNode *child = &children[best];
+                if (isAttacker) {
+                        childThPn = min(thPn, pnAdd(second, second / 4 + 1));
+                        childThDn = (thDn >= pnInfinity) ? pnInfinity : thDn - node.dn + child->dn;
+                } else {
+                        childThDn = min(thDn, pnAdd(second, second / 4 + 1));
+                        childThPn = (thPn >= pnInfinity) ? pnInfinity : thPn - node.pn + child->pn;
+                }
+                makeMove(board(self), moves[best]);
+                self->nodeCount++;
+                *child = proofSearch(self, attacker, plies - 1, childThPn, childThDn);
+                undoMove(board(self));
+        }
+
+        mateWrite(self, attacker, plies, node, self->nodeCount - startCount);
+        return node;
+}
+
+/*
+ *  Generate the legal moves with the current numbers of their positions.
+ *  Positions decided without a search return no moves, and the result
+ *  in children[0].
+ */
+static int expandNode(Engine_t self, int attacker, int plies, int moves[], struct mateNode children[])
+{
+        Board_t board = board(self);
+        bool isAttacker = sideToMove(board) == attacker;
+        bool inCheck = isInCheck(board);
+        int moveList[maxMoves];
+        int nrMoves = generateMoves(board, moveList);
+        int nrLegal = 0, n = 0;
+        bool mateFound = false;
+
+        for (int i=0; i<nrMoves && !mateFound; i++) {
+                makeMove(board, moveList[i]);
+                if (wasLegalMove(board)) {
+                        nrLegal++;
+                        bool givesCheck = isInCheck(board);
+                        if (isAttacker && plies == 1) {
+                                // Last move: only a check can mate, then see if it does
+                                if (givesCheck) {
+                                        int replies[maxMoves];
+                                        int nrReplies = generateMoves(board, replies);
+                                        mateFound = true;
+                                        for (int j=0; j<nrReplies && mateFound; j++)
+                                                mateFound = !isLegalMove(board, replies[j]);
+                                        if (mateFound)
+                                                moves[0] = moveList[i];
+                                }
+                        } else if (plies > 1) {
+                                moves[n] = moveList[i];
+                                int pn = (isAttacker && !givesCheck) ? 2 : 1; // Checks first
+                                children[n++] = mateRead(self, attacker, plies - 1, pn);
+                        }
+                }
+                undoMove(board);
+                self->nodeCount++;
+        }
+
+        struct mateNode proven    = { .pn = 0, .dn = pnInfinity, .plies = 0 };
+        struct mateNode disproven = { .pn = pnInfinity, .dn = 0, .plies = plies };
+
+        if (mateFound) {
+                children[0] = proven;
+                children[0].plies = 1;
+                children[0].move = moves[0];
+                return 0;
+        }
+        if (nrLegal == 0) {
+                children[0] = (!isAttacker && inCheck) ? proven : disproven;
+                return 0;
+        }
+        if (n == 0) { // No time left to mate
+                children[0] = disproven;
+                return 0;
+        }
+        return n;
+}
+
+/*----------------------------------------------------------------------+
+ |      Node table                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  A proof holds for at least as many plies as it needs, a disproof
+ *  for at most as many as it was made for. Other numbers only count
+ *  for the same number of plies to go. Unknown positions get the
+ *  given proof number.
+ */
+static struct mateNode mateRead(Engine_t self, int attacker, int plies, unsigned int pn)
+{
+        uint64_t hash = board(self)->hash ^ attackerKeys[attacker];
+        struct mateSlot *bucket = &self->mateTable.slots[hash & ones(mateTableBits) & ~(mateBucketSize - 1)];
+
+        for (int i=0; i<mateBucketSize; i++) {
+                struct mateSlot *slot = &bucket[i];
+                if (slot->hash == hash
+                 && ((slot->pn == 0 && slot->plies <= plies)
+                  || (slot->dn == 0 && slot->plies >= plies)
+                  || (slot->plies == plies)))
+                        return (struct mateNode) { slot->pn, slot->dn, slot->plies, slot->move };
+        }
+        return (struct mateNode) { pn, 1, plies, 0 };
+}
+
+/*
+ *  Replace the same position, else the entry that took the least work
+ */
+static void mateWrite(Engine_t self, int attacker, int plies, struct mateNode node, long long work)
+{
+        uint64_t hash = board(self)->hash ^ attackerKeys[attacker];
+        struct mateSlot *bucket = &self->mateTable.slots[hash & ones(mateTableBits) & ~(mateBucketSize - 1)];
+
+        struct mateSlot *slot = &bucket[0];
+        for (int i=0; i<mateBucketSize; i++) {
+                if (bucket[i].hash == hash) {
+                        slot = &bucket[i];
+                        work += slot->work; // It adds up
+                        break;
+                }
+                if (bucket[i].work < slot->work)
+                        slot = &bucket[i];
+        }
+
+        *slot = (struct mateSlot) {
+                .hash = hash,
+                .pn = node.pn,
+                .dn = node.dn,
+                .plies = (node.pn == 0) ? node.plies : plies,
+                .move = node.move,
+                .work = min(work, maxInt),
+        };
+}
+
+/*
+ *  Follow the proof from the node table into the principal variation
+ */
+static int proofLine(Engine_t self, int attacker, int plies)
+{
+        self->pv.len = 0;
+        for (int i=0; i<plies; i++) {
+                struct mateNode node = mateRead(self, attacker, plies - i, 1);
+                int moves[maxMoves];
+                int nrMoves = generateMoves(board(self), moves);
+                int move = 0;
+                for (int j=0; j<nrMoves && node.pn == 0; j++)
+                        if (moves[j] == node.move && isLegalMove(board(self), moves[j]))
+                                move = moves[j];
+                if (!move)
+                        break;
+                pushList(self->pv, move);
+                makeMove(board(self), move);
+        }
+        for (int i=0; i<self->pv.len; i++)
+                undoMove(board(self));
+        return self->pv.len;
+}
+
+static bool mateAborted(Engine_t self)
+{
+        return self->nodeCount >= self->target.nodeCount || PyErr_CheckSignals() == -1;
+}
+
+/*----------------------------------------------------------------------+
+ |                                                                      |
+ +----------------------------------------------------------------------*/
+
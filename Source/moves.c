@@ -22,6 +22,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 // C extension
@@ -833,6 +834,78 @@ int isInCheck(Board_t self)
         return self->sides[other(side)].attacks[self->sides[side].king] != 0;
 }
 
+/*----------------------------------------------------------------------+
+ |      isCheckingMove                                                  |
+ +----------------------------------------------------------------------*/
+
+#define sign(x) (((x) > 0) - ((x) < 0))
+
+// Helper to find the first occupied square along a line, as if the move was made
+static int scanLine(Board_t self, int square, int df, int dr, int from, int to)
+{
+        int f = file(square) + df, r = rank(square) + dr;
+        for (; inRange(f, fileA, fileH) && inRange(r, rank1, rank8); f+=df, r+=dr) {
+                int next = square(f, r);
+                if (next == to || (next != from && self->squares[next] != empty))
+                        return next;
+        }
+        return -1;
+}
+
+/*
+ *  Does the move give check? Special moves are conservatively reported
+ *  as checking moves, so that they can be excluded from pruning.
+ */
+bool isCheckingMove(Board_t self, int move)
+{
+        if (move & specialMoveFlag)
+                return true;
+
+        updateSideInfo(self);
+        int side = sideToMove(self);
+        int xking = self->sides[other(side)].king;
+        int from = from(move), to = to(move);
+        int piece = self->squares[from] - side * (blackKing - whiteKing); // as white
+
+        // Direct check
+        int df = file(xking) - file(to), dr = rank(xking) - rank(to);
+        bool isOrthogonal = (df == 0 || dr == 0);
+        bool isDiagonal = (abs(df) == abs(dr));
+        switch (piece) {
+        case whitePawn:
+                if (abs(df) == 1 && dr == (side == white ? 1 : -1))
+                        return true;
+                break;
+        case whiteKnight:
+                if (abs(df * dr) == 2)
+                        return true;
+                break;
+        case whiteBishop: case whiteRook: case whiteQueen:
+                if ((piece != whiteBishop && isOrthogonal) || (piece != whiteRook && isDiagonal))
+                        if (scanLine(self, xking, -sign(df), -sign(dr), from, to) == to)
+                                return true;
+                break;
+        }
+
+        // Discovered check
+        df = file(from) - file(xking), dr = rank(from) - rank(xking);
+        isOrthogonal = (df == 0 || dr == 0);
+        isDiagonal = (abs(df) == abs(dr));
+        if (isOrthogonal || isDiagonal) {
+                int square = scanLine(self, xking, sign(df), sign(dr), from, to);
+                if (square >= 0 && square != to) {
+                        int slider = self->squares[square];
+                        if (slider != empty && pieceColor(slider) == side) {
+                                slider -= side * (blackKing - whiteKing);
+                                if (slider == whiteQueen
+                                 || slider == (isDiagonal ? whiteBishop : whiteRook))
+                                        return true;
+                        }
+                }
+        }
+        return false;
+}
+
 /*----------------------------------------------------------------------+
  |      normalizeEnPassantStatus                                        |
  +----------------------------------------------------------------------*/
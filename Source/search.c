@@ -26,6 +26,7 @@
 
 // C standard
 #include <assert.h>
+#include <errno.h>
 #include <math.h>
 #include <setjmp.h>
 #include <stdbool.h>
@@ -40,18 +41,23 @@
 #include "Board.h"
 #include "Engine.h"
 
+// Other modules
+#include "zobrist.h"
+
 /*----------------------------------------------------------------------+
  |      Definitions                                                     |
  +----------------------------------------------------------------------*/
 
 struct Node {
         struct ttSlot slot;
+        int excludedMove; // Never emitted by the move generator
+        int quietLimit; // Quiet moves with a lower history count are pruned, unless checking
         int phase; // Lazy move generation
         int nrMoves, i;
         int moveList[maxMoves];
 };
 
-// 6 bits signed        11 bits        3 bits     6 bits       6 bits
+// 6 bits signed     11 bits offset     3 bits     6 bits       6 bits
 // +------------+---------------------+-------+------------+------------+
 // |  SEE score |    history score    |  tag  |    from    |     to     |
 // +------------+---------------------+-------+------------+------------+
@@ -61,7 +67,65 @@ struct Node {
 #define moveMask ((int) ones(15))
 #define moveScore(longMove) ((longMove) >> 26) // Extract score from move list entry
 #define historyBits 11 // 15 for a move and 6 for SEE leaves 11 for history
+#define historyOffset (1 << (historyBits - 1))
+#define moveHistory(longMove) ((int) (((longMove) >> 15) & ones(historyBits)) - historyOffset)
 #define historyIndex(move) ((int) ((move) & ones(12)))
+#define pieceToIndex(piece, square) (((piece) << boardBits) + (square))
+#define isQuietMove(board, move) ((board)->squares[to(move)] == empty && !((move) & specialMoveFlag))
+#define isCapture(board, move) ((board)->squares[to(move)] != empty)
+
+// ProbCut: a capture that beats beta by a margin at reduced depth cuts
+#define probCutMinDepth 7
+#define probCutReduction 3
+#define probCutMargin 1000 // In millipawns
+
+// Multi-cut: several moves failing high at reduced depth cut
+#define multiCutMinDepth 8
+#define multiCutReduction 4
+#define multiCutMoves 4 // Moves to try
+#define multiCutCount 2 // Fail highs needed
+
+// Singular extension of the hash move
+#define singularMinDepth 8
+#define singularMaxDepthDiff 3 // How much shallower the hash entry may be
+#define singularMargin(depth) (20 * (depth)) // In millipawns
+
+// History tables
+#define historyMax 8192 // Each table entry stays within [-historyMax, historyMax]
+#define historyBonus(depth) min(32 * (depth) * (depth), historyMax / 4)
+
+// Late move reductions
+#define lmrMinDepth 3
+#define lmrGoodHistory (historyOffset / 4) // Reduce one ply less from here
+
+// Pruning of late quiet moves at shallow depth
+#define lmpMaxDepth 4
+#define historyPruningMaxDepth 2
+#define historyPruningMoveCount 4 // Moves to try before history pruning starts
+#define historyPruningLimit (-historyOffset / 4) // Prune when the history score is below this
+
+// Probability density search
+#define pdsPly 100 // Budget units per iteration, about one ply of PVS depth
+#define pdsMinCost (pdsPly / 4) // So that forced lines still end
+
+// MTD(f)
+#define mtdStep 16 // First step in millipawns when a pass misses the guess
+
+/*----------------------------------------------------------------------+
+ |      Data                                                            |
+ +----------------------------------------------------------------------*/
+
+static signed char reductionTable[64][64]; // [depth][moveNumber] in plies
+
+// Cuckoo tables of reversible moves, for upcomingRepetition
+#define cuckooLen 8192 // must be power of 2
+#define cuckoo1(key) ((int) ( (key)        & (cuckooLen - 1)))
+#define cuckoo2(key) ((int) (((key) >> 16) & (cuckooLen - 1)))
+static uint64_t cuckooKeys[cuckooLen];
+static short cuckooMoves[cuckooLen];
+
+// Moves to try before late move pruning starts
+static const int lmpMoveCount[lmpMaxDepth+1] = { 0, 6, 9, 14, 21 };
 
 /*----------------------------------------------------------------------+
  |      Functions                                                       |
@@ -70,18 +134,45 @@ struct Node {
 static int pvSearch(Engine_t self, int depth, int alpha, int beta, int pvIndex);
 static int scout(Engine_t self, int depth, int alpha, int pvDistance, int lastMove);
 static int qSearch(Engine_t self, int alpha);
+static int pdSearch(Engine_t self, int budget, int alpha, int beta, int pvIndex);
+static void moveCosts(const int moveList[], int nrMoves, int hashMove, int cost[]);
+static int mtdSearch(Engine_t self, int depth, int guess);
+static int mtdRoot(Engine_t self, int depth, int alpha, int *bestMove);
+static void pvFromTable(Engine_t self, int move, int maxLen);
+static inline void pollAbort(Engine_t self);
 
 static int updateBestAndPonderMove(Engine_t self);
+static void prepareRootMoves(Engine_t self);
+static void updateRootMove(Engine_t self, int move, int score, long long nodeCount);
+static void updateRootLine(Engine_t self, int move, const int pv[], int pvLen);
+static int multiPvBound(Engine_t self, int nrLines);
+static void sortRootMoves(Engine_t self);
+static bool isRootMove(Engine_t self, int move);
+static void playInstantMove(Engine_t self, int move, int score, int depth);
+static double timeFactor(int stableIterations, int scoreDrop, double bestMoveShare);
 static int staticMoveScore(Board_t self, int move);
 static int filterAndSort(Engine_t self, int moveList[], int nrMoves, int moveFilter);
 static int filterLegalMoves(Board_t self, int moveList[], int nrMoves);
 static bool moveToFront(int moveList[], int nrMoves, int move);
 static bool repetition(Engine_t self);
+static void initCuckooTables(void);
+static bool upcomingRepetition(Engine_t self);
 static bool allowNullMove(Board_t self);
+static bool isSingularMove(Engine_t self, struct ttSlot slot, int depth, int pvDistance);
 
 static void killersToFront(Engine_t self, int ply, int moveList[], int nrMoves);
 static void updateKillers(Engine_t self, int ply, int move);
-static void updateHistory(short historyCounts[], int index, int depth);
+static void updateHistory(short *entry, int bonus);
+static void updateQuietHistory(Engine_t self, int depth, int move, const int quiets[], int nrQuiets);
+static int quietHistory(Engine_t self, int move, const short *counter, const short *followup);
+static short *captureHistoryEntry(Engine_t self, int move);
+static void updateCaptureHistory(Engine_t self, int depth, int move, const int captures[], int nrCaptures);
+static void setContinuationKey(Engine_t self, int move);
+static void ageMoveOrdering(Engine_t self, int pliesPlayed);
+static int continuationKey(Engine_t self, int ply);
+
+static void initReductionTable(void);
+static int lateMoveReduction(int depth, int j, int move, bool isCutNode);
 
 static int makeFirstMove(Engine_t self, struct Node *node);
 static int makeNextMove(Engine_t self, struct Node *node);
@@ -93,6 +184,7 @@ static int makeNextMove(Engine_t self, struct Node *node);
 void abortSearch(void *engine)
 {
         Engine_t self = engine;
+        self->abortTime = xTime();
         self->target.nodeCount = 0;
 }
 
@@ -100,36 +192,126 @@ void abortSearch(void *engine)
 void rootSearch(Engine_t self)
 {
         double startTime = xTime();
+        double startCpuTime = self->target.watchCpuTime ? xThreadTime() : 0.0;
         self->nodeCount = 0;
+        int lastRootPlyNumber = self->rootPlyNumber;
         self->rootPlyNumber = board(self)->plyNumber;
+        if (reductionTable[63][63] == 0) { // Implicit initialization
+                initCuckooTables();
+                initReductionTable();
+        }
 
         assert(board(self)->hash == hash(board(self)));
         if (hash(board(self)) != self->lastSearched) {
+                // Is this root reached by playing on from the previous one?
+                int pliesPlayed = self->rootPlyNumber - lastRootPlyNumber;
+                uint64List *history = &board(self)->hashHistory;
+                bool continuesGame = inRange(pliesPlayed, 1, history->len)
+                                  && history->v[history->len - pliesPlayed] == self->lastSearched;
                 self->lastSearched = hash(board(self));
                 self->pv.len = 0;
-                self->killers.len = 0;
                 self->bestMove = self->ponderMove = 0;
                 self->tt.now = (self->tt.now + 1) & ones(ttDateBits);
-                memset(self->historyCounts, 0, sizeof self->historyCounts);
+                if (self->ageHistory && continuesGame)
+                        ageMoveOrdering(self, pliesPlayed);
+                else {
+                        self->killers.len = 0;
+                        memset(self->historyCounts, 0, sizeof self->historyCounts);
+                        memset(self->pieceToHistory, 0, sizeof self->pieceToHistory);
+                        memset(self->captureHistory, 0, sizeof self->captureHistory);
+                        memset(self->counterMoves, 0, sizeof self->counterMoves);
+                        if (self->continuationHistory)
+                                memset(self->continuationHistory, 0, nrPieceTo * sizeof self->continuationHistory[0]);
+                }
         }
 
+        if (!self->continuationHistory) {
+                self->continuationHistory = calloc(nrPieceTo, sizeof self->continuationHistory[0]);
+                if (!self->continuationHistory)
+                        xAbort(errno, "calloc");
+        }
+        setContinuationKey(self, 0000); // No known last move at the root
+        prepareRootMoves(self);
+
         if (self->target.maxTime > 0.0 && !self->pondering)
                 self->alarmHandle = setAlarm(self->target.maxTime, abortSearch, self);
 
-        // Prepare abort possibility
+        // Prepare abort possibility, armed once an iteration gives a move
         jmp_buf here;
-        self->abortTarget = &here;
+        self->abortTarget = null;
+
+        // Time management state
+        int lastBestMove = 0, stableIterations = 0;
+        int lastScore = 0;
+
+        /*
+         *  Reuse earlier work. In games, play a single reply or a proven win
+         *  without searching. When the root entry is already as deep as the
+         *  requested depth, only do the last iteration, following its move.
+         *  (Starting at a shallower entry's depth costs more than it saves,
+         *  because the skipped iterations are what warm up move ordering.)
+         */
+        struct ttSlot rootSlot = ttRead(self);
+        bool haveRootSlot = isRootMove(self, rootSlot.move);
+        bool inGame = self->target.time > 0.0 && !self->pondering;
+        bool instantMove = false;
+        int firstIteration = 0;
+
+        if (inGame && self->rootMoves.len == 1) {
+                int score = haveRootSlot ? rootSlot.score : evaluate(board(self));
+                playInstantMove(self, self->rootMoves.v[0].move, score, rootSlot.depth);
+                instantMove = true;
+        } else if (inGame && haveRootSlot && isWinScore(rootSlot.score)
+                && (rootSlot.isHardBound || !rootSlot.isUpperBound)) {
+                playInstantMove(self, rootSlot.move, rootSlot.score, rootSlot.depth);
+                instantMove = true;
+        } else if (haveRootSlot && rootSlot.depth >= self->target.depth) {
+                firstIteration = self->target.depth;
+                self->pv.len = 0;
+                pushList(self->pv, rootSlot.move);
+                self->abortTarget = &here; // Safe, there is a move already
+        }
 
-        if (setjmp(here) == 0) { // try search
-                for (int iteration=0; iteration<=self->target.depth; iteration++) {
+        if (instantMove) {
+                self->seconds = xTime() - startTime;
+                self->infoFunction(self->infoData);
+        } else if (setjmp(here) == 0) { // try search
+                for (int iteration=firstIteration; iteration<=self->target.depth; iteration++) {
                         self->mateStop = true;
                         self->depth = iteration;
-                        self->score = pvSearch(self, iteration, -maxInt, maxInt, 0);
+                        long long startCount = self->nodeCount;
+                        if (self->pds)
+                                self->score = pdSearch(self, iteration * pdsPly, -maxInt, maxInt, 0);
+                        else if (self->mtd && iteration > firstIteration && self->multiPv == 1)
+                                self->score = mtdSearch(self, iteration, self->score);
+                        else
+                                self->score = pvSearch(self, iteration, -maxInt, maxInt, 0);
+                        if (self->pv.len > 0)
+                                self->abortTarget = &here;
                         self->seconds = xTime() - startTime;
-                        self->infoFunction(self->infoData);
                         updateBestAndPonderMove(self);
+                        sortRootMoves(self);
+                        self->infoFunction(self->infoData);
+
+                        stableIterations = (self->bestMove == lastBestMove) ? stableIterations + 1 : 0;
+                        lastBestMove = self->bestMove;
+                        int scoreDrop = (iteration > firstIteration) ? lastScore - self->score : 0;
+                        lastScore = self->score;
+                        double bestMoveShare = (self->rootMoves.len > 0)
+                                ? (double) self->rootMoves.v[0].nodeCount / (self->nodeCount - startCount)
+                                : 0.0;
+                        double budget = min(self->target.time * timeFactor(stableIterations, scoreDrop, bestMoveShare),
+                                            self->target.maxTime);
+                        double elapsed = (self->target.nodeRate > 0.0)
+                                       ? self->nodeCount / self->target.nodeRate
+                                       : self->seconds;
+                        if (self->target.watchCpuTime && self->target.nodeRate == 0.0 && self->seconds > 0.01) {
+                                // Back off when the host is oversubscribed
+                                double cpuShare = (xThreadTime() - startCpuTime) / self->seconds;
+                                budget *= max(0.5, min(cpuShare, 1.0));
+                        }
                         bool moveReady = self->bestMove && (self->target.time > 0.0)
-                                      && (self->seconds >= 0.5 * self->target.time);
+                                      && (elapsed >= 0.5 * budget);
                         if (self->score <= self->target.scores.v[0]
                          || self->score >= self->target.scores.v[1]
                          || (isMateScore(self->score) && self->mateStop && self->depth > 0)
@@ -147,10 +329,27 @@ void rootSearch(Engine_t self)
 
         clearAlarm(self->alarmHandle);
         self->alarmHandle = null;
+        self->abortTarget = null;
+}
+
+/*----------------------------------------------------------------------+
+ |      pollAbort                                                       |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Unwind to rootSearch when the node budget is spent or abortSearch was
+ *  called. Polled on entry of every node type, quiescence included, so the
+ *  stop latency doesn't depend on where the search happens to be.
+ */
+static inline void pollAbort(Engine_t self)
+{
+        if (self->nodeCount >= self->target.nodeCount || PyErr_CheckSignals() == -1)
+                if (self->abortTarget)
+                        longjmp(self->abortTarget, 1); // Raise abort
 }
 
 /*----------------------------------------------------------------------+
- |      gameOverScore / drawScore                                       |
+ |      gameOverScore / drawScore / nodeEval                            |
  +----------------------------------------------------------------------*/
 
 static inline int gameOverScore(Engine_t self, bool inCheck)
@@ -164,18 +363,27 @@ static inline int drawScore(Engine_t self)
         return 0; // TODO: heuristic draws
 }
 
+// Static evaluation, with endgame table distances counted from the root like mates
+static inline int nodeEval(Engine_t self)
+{
+        int eval = evaluate(board(self));
+        if (isWinScore(eval)) eval -= ply(self);
+        if (isLossScore(eval)) eval += ply(self);
+        return eval;
+}
+
 /*----------------------------------------------------------------------+
  |      pvSearch                                                        |
  +----------------------------------------------------------------------*/
 
 // TODO: end game extension
-// TODO: singular extension
 static int pvSearch(Engine_t self, int depth, int alpha, int beta, int pvIndex)
 {
         self->nodeCount++;
+        pollAbort(self);
         bool inRoot = (ply(self) == 0);
         #define cutPv() (self->pv.len = pvIndex)
-        int eval = evaluate(board(self));
+        int eval = nodeEval(self);
 
         if (!inRoot && (eval == 0 || repetition(self)))
                 return cutPv(), drawScore(self);
@@ -200,17 +408,30 @@ static int pvSearch(Engine_t self, int depth, int alpha, int beta, int pvIndex)
                 moveFilter = 0; // Only good captures
         }
 
-        // Generate moves, or use the `searchmoves' list when specified
+        // Generate moves, or take them from the root move list
         int moveList[maxMoves];
-        int nrMoves = generateMoves(board(self), moveList);
-        if (inRoot && self->searchMoves.len > 0) {
-                nrMoves = self->searchMoves.len;
-                memcpy(moveList, self->searchMoves.v, nrMoves * sizeof(int));
+        int nrMoves;
+        if (inRoot && depth > 0) {
+                nrMoves = self->rootMoves.len;
+                for (int i=0; i<nrMoves; i++)
+                        moveList[i] = self->rootMoves.v[i].move;
+        } else {
+                nrMoves = generateMoves(board(self), moveList);
+                if (inRoot && self->searchMoves.len > 0) {
+                        nrMoves = self->searchMoves.len;
+                        memcpy(moveList, self->searchMoves.v, nrMoves * sizeof(int));
+                }
+                nrMoves = filterAndSort(self, moveList, nrMoves, moveFilter);
+                nrMoves = filterLegalMoves(board(self), moveList, nrMoves); // Easier for PVS
         }
-        nrMoves = filterAndSort(self, moveList, nrMoves, moveFilter);
-        nrMoves = filterLegalMoves(board(self), moveList, nrMoves); // Easier for PVS
         moveToFront(moveList, nrMoves, slot.move);
 
+        // With MultiPV, search the best few root moves with open window
+        int nrLines = (inRoot && depth > 0) ? min(self->multiPv, nrMoves) : 1;
+        if (nrLines > 1)
+                for (int i=0; i<self->rootMoves.len; i++)
+                        self->rootMoves.v[i].pv.len = 0;
+
         // Search the first move with open alpha-beta window
         if (nrMoves > 0) {
                 if (pvIndex < self->pv.len)
@@ -219,8 +440,12 @@ static int pvSearch(Engine_t self, int depth, int alpha, int beta, int pvIndex)
                         pushList(self->pv, moveList[0]); // Expand the PV
                 int move = moveList[0];
                 bool recapture = moveScore(move) > 0 && to(move) == recaptureSquare(board(self));
+                bool singular = !inRoot && (move & moveMask) == slot.move
+                             && isSingularMove(self, slot, depth, 0);
+                long long startCount = self->nodeCount;
                 makeMove(board(self), move);
-                int extension = (inCheck || recapture) + (nrMoves == 1 && (depth > 0));
+                setContinuationKey(self, move);
+                int extension = (inCheck || recapture || singular) + (nrMoves == 1 && (depth > 0));
                 int newDepth = max(0, depth - 1 + extension);
                 int newAlpha = max(alpha, bestScore);
                 int score = -pvSearch(self, newDepth, -beta, -newAlpha, pvIndex + 1);
@@ -230,27 +455,42 @@ static int pvSearch(Engine_t self, int depth, int alpha, int beta, int pvIndex)
                 } else
                         cutPv(); // Quiescence (standing pat)
                 undoMove(board(self));
+                if (inRoot)
+                        updateRootMove(self, move, score, self->nodeCount - startCount);
+                if (nrLines > 1)
+                        updateRootLine(self, move, &self->pv.v[pvIndex], self->pv.len - pvIndex);
         } else
                 cutPv(); // Game end or leaf node (horizon)
 
         // Try the others with zero window and reductions, research if needed
-        int reduction = min(2, depth / 5);
         for (int i=1; i<nrMoves && bestScore<beta; i++) {
                 int move = moveList[i];
                 bool recapture = moveScore(move) > 0 && to(move) == recaptureSquare(board(self));
+                long long startCount = self->nodeCount;
                 makeMove(board(self), move);
+                setContinuationKey(self, move);
                 int extension = (inCheck || recapture);
+                int reduction = 0;
+                if (depth >= lmrMinDepth && !extension && !isInCheck(board(self)))
+                        reduction = max(0, lateMoveReduction(depth, i, move, false) - 1);
                 int newDepth = max(0, depth - 1 + extension - reduction);
                 int newAlpha = max(alpha, bestScore);
-                int score = -scout(self, newDepth, -(newAlpha+1), 1, move);
+                int researchBound = bestScore;
+                if (nrLines > 1) // Against the weakest of the top lines instead
+                        newAlpha = researchBound = max(alpha, multiPvBound(self, nrLines));
+                int score = (newAlpha > -maxInt)
+                          ? -scout(self, newDepth, -(newAlpha+1), 1, move)
+                          : maxInt; // Not enough lines yet, search with open window
                 if (!isMateScore(score) && !isDrawScore(score))
                         self->mateStop = false; // Shortest mate not yet proven
-                if (score > bestScore) {
+                if (score > researchBound) {
                         pushList(self->pv, 0); // Separator
                         int pvLen = self->pv.len;
                         pushList(self->pv, move);
                         int researchDepth = max(0, depth - 1 + extension);
                         score = -pvSearch(self, researchDepth, -beta, -newAlpha, pvLen + 1);
+                        if (nrLines > 1 && score > newAlpha)
+                                updateRootLine(self, move, &self->pv.v[pvLen], self->pv.len - pvLen);
                         if (score > bestScore) {
                                 bestScore = score;
                                 slot.move = move & moveMask;
@@ -261,6 +501,8 @@ static int pvSearch(Engine_t self, int depth, int alpha, int beta, int pvIndex)
                                 self->pv.len = pvLen - 1; // The research failed, it happens
                 }
                 undoMove(board(self));
+                if (inRoot)
+                        updateRootMove(self, move, score, self->nodeCount - startCount);
         }
 
         if (bestScore == minInt) // No legal moves
@@ -276,10 +518,10 @@ static int pvSearch(Engine_t self, int depth, int alpha, int beta, int pvIndex)
 static int scout(Engine_t self, int depth, int alpha, int pvDistance, int lastMove)
 {
         self->nodeCount++;
+        pollAbort(self);
         if (repetition(self)) return drawScore(self);
+        if (alpha < drawScore(self) && upcomingRepetition(self)) return drawScore(self);
         if (depth == 0) return qSearch(self, alpha); // TODO: we can put horizon stuff here
-        if (self->nodeCount >= self->target.nodeCount || PyErr_CheckSignals() == -1)
-                longjmp(self->abortTarget, 1); // Raise abort
 
         // Mate distance pruning
         int mateBound = maxMate - ply(self) - 2;
@@ -298,6 +540,7 @@ static int scout(Engine_t self, int depth, int alpha, int pvDistance, int lastMo
         if (depth >= 2 && inRange(alpha, minEval, maxEval-1)
          && lastMove != 0000 && !inCheck && allowNullMove(board(self))) {
                 makeNullMove(board(self));
+                setContinuationKey(self, 0000);
                 int reduction = min((depth + 1) / 2, 3); // R = 1..3
                 int score = -scout(self,  depth - reduction - 1, -(alpha+1), pvDistance+1, 0000);
                 undoMove(board(self));
@@ -312,7 +555,7 @@ static int scout(Engine_t self, int depth, int alpha, int pvDistance, int lastMo
         int bestScore = minInt;
         int moveFilter = minInt;
         if (depth == 1 && inRange(alpha, minEval, maxEval-1) && !inCheck) {
-                int eval = evaluate(board(self));
+                int eval = nodeEval(self);
                 if (eval - board(self)->futilityMargin > alpha) // Reverse futility (aka static null move)
                         return ttWrite(self, node.slot, depth, alpha+1, alpha, alpha+1);
                 static const int margin[]  = { 2000, 1500 };
@@ -321,13 +564,13 @@ static int scout(Engine_t self, int depth, int alpha, int pvDistance, int lastMo
         }
         else if (depth == 2 && inRange(alpha, minEval, maxEval-1) && !inCheck) {
                 // Extended futility at pre-frontier nodes
-                int eval = evaluate(board(self));
+                int eval = nodeEval(self);
                 if (eval + 4000 <= alpha)
                         moveFilter = 0, bestScore = eval + 4000;
         }
         else if (depth == 3 && inRange(alpha, minEval, maxEval-1) && !inCheck) {
                 // Razoring at pre-pre-frontier nodes
-                int eval = evaluate(board(self));
+                int eval = nodeEval(self);
                 if (eval + 6000 <= alpha) {
                         int score = scout(self, depth-2, alpha, pvDistance, 0000);
                         node.slot = ttRead(self);
@@ -336,22 +579,88 @@ static int scout(Engine_t self, int depth, int alpha, int pvDistance, int lastMo
                 }
         }
 
-        // Internal iterative deepening
+        // ProbCut: try good captures against a raised bound, first in quiescence
         #define isCutNode(pvDistance) isOdd(pvDistance)
+        if (depth >= probCutMinDepth && isCutNode(pvDistance) && !inCheck
+         && inRange(alpha, minEval, maxEval - probCutMargin - 1)
+         && !(node.slot.depth >= depth - probCutReduction && node.slot.isUpperBound
+              && node.slot.score <= alpha + probCutMargin)) {
+                int probAlpha = alpha + probCutMargin;
+                int moveList[maxMoves];
+                int nrMoves = generateMoves(board(self), moveList);
+                nrMoves = filterAndSort(self, moveList, nrMoves, 0); // Good captures
+                for (int i=0; i<nrMoves; i++) {
+                        int move = moveList[i];
+                        makeMove(board(self), move);
+                        if (!wasLegalMove(board(self))) {
+                                undoMove(board(self));
+                                continue;
+                        }
+                        self->nodeCount++;
+                        setContinuationKey(self, move);
+                        int score = -qSearch(self, -(probAlpha+1));
+                        if (score > probAlpha)
+                                score = -scout(self, depth - probCutReduction - 1, -(probAlpha+1), pvDistance+1, move);
+                        undoMove(board(self));
+                        if (score > probAlpha) {
+                                node.slot.move = move & moveMask;
+                                return ttWrite(self, node.slot, depth - probCutReduction, score, alpha, alpha+1);
+                        }
+                }
+        }
+
+        // Internal iterative deepening
         if (depth >= 3 && isCutNode(pvDistance) && !node.slot.move) {
                 scout(self, depth - 2, alpha, pvDistance, lastMove);
                 node.slot = ttRead(self);
         }
 
+        // Multi-cut: prune when several of the first moves fail high at reduced depth
+        if (depth >= multiCutMinDepth && isCutNode(pvDistance) && !inCheck
+         && inRange(alpha, minEval, maxEval-1)) {
+                struct Node mcNode;
+                mcNode.slot = node.slot;
+                mcNode.excludedMove = 0;
+                int nrCuts = 0, cutScore = maxInt;
+                int move = makeFirstMove(self, &mcNode);
+                for (int j=0; move; j++) {
+                        int score = -scout(self, depth - multiCutReduction - 1, -(alpha+1), pvDistance+1, move);
+                        undoMove(board(self));
+                        if (score > alpha) {
+                                cutScore = min(cutScore, score);
+                                if (++nrCuts >= multiCutCount)
+                                        return ttWrite(self, node.slot, depth - multiCutReduction, cutScore, alpha, alpha+1);
+                        }
+                        move = (j + 1 < multiCutMoves) ? makeNextMove(self, &mcNode) : 0;
+                }
+        }
+
+        // Extend the hash move if all alternatives are clearly worse
+        bool singular = isSingularMove(self, node.slot, depth, pvDistance);
+
         // Recursively search all moves until exhausted or one fails high
-        int extension = inCheck;
+        node.excludedMove = 0;
+        int quiets[maxMoves], nrQuiets = 0; // For history maluses
+        int captures[maxMoves], nrCaptures = 0;
         for (int move=makeFirstMove(self,&node), j=0; move; move=makeNextMove(self,&node), j++) {
-                if (move < moveFilter && !isInCheck(board(self))) {
+                // Prune late quiet moves from here on, before they are even made
+                if (!inCheck && inRange(alpha, minEval, maxEval-1)) {
+                        if (depth <= lmpMaxDepth && j + 1 >= lmpMoveCount[depth])
+                                node.quietLimit = maxInt;
+                        else if (depth <= historyPruningMaxDepth && j + 1 >= historyPruningMoveCount)
+                                node.quietLimit = historyPruningLimit;
+                }
+
+                bool givesCheck = isInCheck(board(self));
+                if (move < moveFilter && !givesCheck) {
                         undoMove(board(self)); // Move is futile and unlikely to fail high
                         continue;
                 }
+                int extension = inCheck || (singular && (move & moveMask) == node.slot.move);
                 int newDepth = max(0, depth - 1 + extension);
-                int reduction = (depth >= 4) && (j >= 1) && (move < 0);
+                int reduction = 0;
+                if (depth >= lmrMinDepth && j >= 1 && move < 0 && !extension && !givesCheck)
+                        reduction = lateMoveReduction(depth, j, move, isCutNode(pvDistance));
                 int reducedDepth = max(0, newDepth - reduction);
                 int score = -scout(self, reducedDepth, -(alpha+1), pvDistance+1, move);
                 if (score > alpha && reducedDepth < newDepth)
@@ -360,12 +669,19 @@ static int scout(Engine_t self, int depth, int alpha, int pvDistance, int lastMo
                 bestScore = max(bestScore, score);
                 if (score > alpha) { // Fail high
                         node.slot.move = move & moveMask;
+                        if (isCapture(board(self), move))
+                                updateCaptureHistory(self, depth, move, captures, nrCaptures);
                         if (j > 0) {
                                 updateKillers(self, ply(self), move);
-                                updateHistory(self->historyCounts, historyIndex(move), depth);
+                                if (isQuietMove(board(self), move))
+                                        updateQuietHistory(self, depth, move, quiets, nrQuiets);
                         }
                         break;
                 }
+                if (isQuietMove(board(self), move))
+                        quiets[nrQuiets++] = move;
+                else if (isCapture(board(self), move))
+                        captures[nrCaptures++] = move;
         }
 
         if (bestScore == minInt) // No legal moves
@@ -374,12 +690,288 @@ static int scout(Engine_t self, int depth, int alpha, int pvDistance, int lastMo
         return ttWrite(self, node.slot, depth, bestScore, alpha, alpha+1);
 }
 
+/*----------------------------------------------------------------------+
+ |      pdSearch                                                        |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Probability density search. Instead of a depth, each node gets a
+ *  budget of log-probability. Every move is given a probability of being
+ *  the best one, estimated from what orders it (hash move, SEE, history),
+ *  and its subtree gets the budget minus the log of that. Likely lines are
+ *  searched deeper and unlikely ones cut short, without separate rules
+ *  for extensions, reductions and pruning. Nodes off the principal
+ *  variation have pvIndex < 0 and a null window.
+ */
+static int pdSearch(Engine_t self, int budget, int alpha, int beta, int pvIndex)
+{
+        bool inPv = (pvIndex >= 0);
+        bool atHorizon = (budget <= 0 || ply(self) >= maxDepth / 2);
+        if (inPv && atHorizon)
+                return pvSearch(self, 0, alpha, beta, pvIndex);
+
+        self->nodeCount++;
+        pollAbort(self);
+        bool inRoot = (ply(self) == 0);
+        if (inPv && !inRoot && (nodeEval(self) == 0 || repetition(self)))
+                return self->pv.len = pvIndex, drawScore(self);
+        if (!inPv) {
+                if (repetition(self)) return drawScore(self);
+                if (alpha < drawScore(self) && upcomingRepetition(self)) return drawScore(self);
+                if (atHorizon) return qSearch(self, alpha);
+        }
+
+        // Transposition table pruning
+        int depth = budget / pdsPly;
+        struct ttSlot slot = ttRead(self);
+        if ((slot.depth >= depth || slot.isHardBound) && !inRoot)
+                if ((slot.isUpperBound && slot.score <= alpha)
+                 || (slot.isLowerBound && slot.score >= beta)
+                 || (slot.isUpperBound && slot.isLowerBound && alpha < slot.score && slot.score < beta)) {
+                        if (inPv) self->pv.len = pvIndex;
+                        return slot.score;
+                }
+
+        // Null move pruning, not twice in a row
+        int inCheck = isInCheck(board(self));
+        if (!inPv && depth >= 2 && inRange(alpha, minEval, maxEval-1) && !inCheck
+         && continuationKey(self, ply(self)) != 0 && allowNullMove(board(self))) {
+                makeNullMove(board(self));
+                setContinuationKey(self, 0000);
+                int reduction = min((depth + 1) / 2, 3); // R = 1..3
+                int score = -pdSearch(self, budget - (reduction + 1) * pdsPly, -(alpha+1), -alpha, -1);
+                undoMove(board(self));
+                if (score > alpha)
+                        return ttWrite(self, slot, depth, min(score, maxEval), alpha, beta);
+        }
+
+        // The moves in search order, only legal ones in the PV
+        int moveList[maxMoves];
+        int nrMoves;
+        if (inRoot) {
+                nrMoves = self->rootMoves.len;
+                for (int i=0; i<nrMoves; i++)
+                        moveList[i] = self->rootMoves.v[i].move;
+        } else {
+                nrMoves = generateMoves(board(self), moveList);
+                nrMoves = filterAndSort(self, moveList, nrMoves, minInt);
+                if (inPv)
+                        nrMoves = filterLegalMoves(board(self), moveList, nrMoves); // Easier for PVS
+                killersToFront(self, ply(self), moveList, nrMoves);
+        }
+        moveToFront(moveList, nrMoves, slot.move);
+        if (inPv && pvIndex < self->pv.len)
+                moveToFront(moveList, nrMoves, self->pv.v[pvIndex]); // Follow the PV
+
+        int cost[maxMoves];
+        moveCosts(moveList, nrMoves, slot.move, cost);
+
+        int bestScore = minInt;
+        int quiets[maxMoves], nrQuiets = 0; // For history maluses
+        int captures[maxMoves], nrCaptures = 0;
+        for (int i=0; i<nrMoves && bestScore<beta; i++) {
+                int move = moveList[i];
+                int newBudget = budget - cost[i];
+                int newAlpha = max(alpha, bestScore);
+                long long startCount = self->nodeCount;
+                if (inPv && i == 0 && pvIndex >= self->pv.len)
+                        pushList(self->pv, move); // Expand the PV
+                makeMove(board(self), move);
+                if (!wasLegalMove(board(self))) {
+                        undoMove(board(self));
+                        continue;
+                }
+                setContinuationKey(self, move);
+                if (isInCheck(board(self))) // Checks are more likely to matter than ordering knows
+                        newBudget = max(newBudget, budget - pdsPly);
+
+                int score;
+                if (inPv && i == 0)
+                        score = -pdSearch(self, newBudget, -beta, -newAlpha, pvIndex + 1);
+                else {
+                        score = -pdSearch(self, newBudget, -(newAlpha+1), -newAlpha, -1);
+                        if (inPv && score > newAlpha) { // Research with open window
+                                pushList(self->pv, 0); // Separator
+                                int pvLen = self->pv.len;
+                                pushList(self->pv, move);
+                                score = -pdSearch(self, newBudget, -beta, -newAlpha, pvLen + 1);
+                                if (score > bestScore) {
+                                        for (int j=0; pvLen+j<self->pv.len; j++)
+                                                self->pv.v[pvIndex+j] = self->pv.v[pvLen+j];
+                                        self->pv.len -= pvLen - pvIndex;
+                                } else
+                                        self->pv.len = pvLen - 1;
+                        }
+                }
+                undoMove(board(self));
+
+                if (inRoot) {
+                        updateRootMove(self, move, score, self->nodeCount - startCount);
+                        if (i > 0 && !isMateScore(score) && !isDrawScore(score))
+                                self->mateStop = false; // Shortest mate not yet proven
+                }
+                if (score > bestScore) {
+                        bestScore = score;
+                        slot.move = move & moveMask;
+                }
+                if (score >= beta) { // Fail high
+                        if (isCapture(board(self), move))
+                                updateCaptureHistory(self, depth, move, captures, nrCaptures);
+                        if (i > 0) {
+                                updateKillers(self, ply(self), move);
+                                if (isQuietMove(board(self), move))
+                                        updateQuietHistory(self, depth, move, quiets, nrQuiets);
+                        }
+                }
+                if (isQuietMove(board(self), move))
+                        quiets[nrQuiets++] = move;
+                else if (isCapture(board(self), move))
+                        captures[nrCaptures++] = move;
+        }
+
+        if (bestScore == minInt) { // No legal moves
+                if (inPv) self->pv.len = pvIndex;
+                bestScore = gameOverScore(self, inCheck);
+        }
+
+        return ttWrite(self, slot, depth, bestScore, alpha, beta);
+}
+
+/*
+ *  Budget needed for each move: minus the log of its probability of being
+ *  best, as a softmax over log-weights taken from the move ordering keys.
+ */
+static void moveCosts(const int moveList[], int nrMoves, int hashMove, int cost[])
+{
+        double weight[maxMoves], sum = 0.0;
+        for (int i=0; i<nrMoves; i++) {
+                int move = moveList[i];
+                double logWeight =
+                        ((move & moveMask) == hashMove) ? 3.0 :
+                        (moveScore(move) > 0)           ? 2.0 : // Good capture
+                        (moveScore(move) < 0)           ? -2.0 : // Loses material
+                        2.0 * moveHistory(move) / historyOffset;
+                weight[i] = exp(logWeight - 0.05 * i); // Killers and the counter move are up front
+                sum += weight[i];
+        }
+        for (int i=0; i<nrMoves; i++)
+                cost[i] = max(pdsMinCost, (int) round(-log(weight[i] / sum) * pdsPly));
+}
+
+/*----------------------------------------------------------------------+
+ |      mtdSearch                                                       |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  MTD(f): find the score of the root by a series of zero-window searches,
+ *  starting from a guess (the score of the previous iteration). Each pass
+ *  tells if the score is above or below a bound and narrows the interval
+ *  until it is closed. Scores are in millipawns, so after a miss the bound
+ *  moves in growing steps and, once the score is bracketed, by bisection.
+ *  The passes share the work through the TT, from which the principal
+ *  variation is then taken.
+ */
+static int mtdSearch(Engine_t self, int depth, int guess)
+{
+        for (int i=0; i<self->rootMoves.len; i++)
+                self->rootMoves.v[i].nodeCount = 0; // Summed over the passes
+
+        int lower = -maxInt, upper = maxInt;
+        int beta = guess, step = mtdStep;
+        int score = guess, bestMove = 0;
+        while (lower < upper) {
+                beta = max(lower + 1, min(beta, upper));
+                int move;
+                score = mtdRoot(self, depth, beta - 1, &move);
+                if (score >= beta)
+                        lower = score, bestMove = move, beta = score + step;
+                else
+                        upper = score, beta = score - step + 1;
+                step *= 2;
+                if (lower > -maxInt && upper < maxInt) // Bisect once bracketed
+                        beta = lower + (upper - lower + 1) / 2;
+        }
+
+        if (isRootMove(self, bestMove))
+                pvFromTable(self, bestMove, depth);
+        return score;
+}
+
+// One zero-window pass over the root moves: is the score above alpha?
+static int mtdRoot(Engine_t self, int depth, int alpha, int *bestMove)
+{
+        self->nodeCount++;
+        pollAbort(self);
+
+        struct ttSlot slot = ttRead(self);
+        int inCheck = isInCheck(board(self));
+        int moveList[maxMoves];
+        int nrMoves = self->rootMoves.len;
+        for (int i=0; i<nrMoves; i++)
+                moveList[i] = self->rootMoves.v[i].move;
+        moveToFront(moveList, nrMoves, slot.move); // The last move to fail high
+
+        int bestScore = minInt;
+        for (int i=0; i<nrMoves && bestScore<=alpha; i++) {
+                int move = moveList[i];
+                bool recapture = moveScore(move) > 0 && to(move) == recaptureSquare(board(self));
+                long long startCount = self->nodeCount;
+                makeMove(board(self), move);
+                setContinuationKey(self, move);
+                int extension = (inCheck || recapture) + (nrMoves == 1);
+                int score = -scout(self, depth - 1 + extension, -(alpha+1), 1, move);
+                undoMove(board(self));
+                if (!isMateScore(score) && !isDrawScore(score))
+                        self->mateStop = false; // Shortest mate not yet proven
+                struct rootMove *rootMove = findRootMove(self, move);
+                rootMove->score = score;
+                rootMove->nodeCount += self->nodeCount - startCount;
+                bestScore = max(bestScore, score);
+                if (score > alpha)
+                        slot.move = move & moveMask;
+        }
+
+        if (bestScore == minInt) // No legal moves
+                bestScore = gameOverScore(self, inCheck);
+
+        *bestMove = slot.move;
+        return ttWrite(self, slot, depth, bestScore, alpha, alpha+1);
+}
+
+// Follow the hash moves from the root, as far as they are legal and new
+static void pvFromTable(Engine_t self, int move, int maxLen)
+{
+        self->pv.len = 0;
+        for (;;) {
+                pushList(self->pv, move);
+                makeMove(board(self), move);
+                if (self->pv.len >= maxLen || repetition(self))
+                        break;
+                move = ttRead(self).move;
+                int moveList[maxMoves];
+                int nrMoves = generateMoves(board(self), moveList);
+                int i = 0;
+                while (i < nrMoves && moveList[i] != move)
+                        i++;
+                if (move == 0 || i == nrMoves || !isLegalMove(board(self), move))
+                        break;
+        }
+        while (ply(self) > 0)
+                undoMove(board(self));
+}
+
 /*----------------------------------------------------------------------+
  |      qSearch                                                         |
  +----------------------------------------------------------------------*/
 
 static int qSearch(Engine_t self, int alpha)
 {
+        pollAbort(self);
+
+        // Only check evasions can still be reversible at this point
+        if (alpha < drawScore(self) && upcomingRepetition(self))
+                return drawScore(self);
+
         // Transposition table pruning
         struct ttSlot slot = ttRead(self);
         if ((slot.isUpperBound && slot.score <= alpha)
@@ -388,7 +980,7 @@ static int qSearch(Engine_t self, int alpha)
 
         // Stand pat if evaluation is good and not in check
         int inCheck = isInCheck(board(self));
-        int bestScore = inCheck ? minInt : evaluate(board(self));
+        int bestScore = inCheck ? minInt : nodeEval(self);
         if (bestScore > alpha)
                 return ttWrite(self, slot, 0, bestScore, alpha, alpha+1);
 
@@ -412,6 +1004,7 @@ static int qSearch(Engine_t self, int alpha)
                 makeMove(board(self), moveList[i]);
                 if (wasLegalMove(board(self))) {
                         self->nodeCount++;
+                        setContinuationKey(self, moveList[i]);
                         int score = -qSearch(self, -(alpha+1));
                         bestScore = max(bestScore, score);
                         if (score > alpha)
@@ -447,18 +1040,152 @@ static bool repetition(Engine_t self)
         return false;
 }
 
+/*----------------------------------------------------------------------+
+ |      upcomingRepetition                                              |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  The hash keys of two positions that are one reversible move apart
+ *  differ by the keys of that piece on its two squares and the turn.
+ *  The cuckoo tables hold this difference for every such move on an
+ *  empty board, so a single lookup tells if a position on the stack
+ *  can be reached again with one move from here. That move is then
+ *  only possible if the squares in between are empty.
+ */
+static void initCuckooTables(void)
+{
+        int count = 0;
+        for (int piece=whiteKing; piece<=blackPawn; piece++) {
+                if (piece == whitePawn || piece == blackPawn)
+                        continue;
+
+                int type = (piece >= blackKing) ? piece - blackKing + whiteKing : piece;
+                for (int from=0; from<boardSize; from++)
+                        for (int to=from+1; to<boardSize; to++) {
+                                int df = abs(file(to) - file(from));
+                                int dr = abs(rank(to) - rank(from));
+                                bool line = (df == 0 || dr == 0), diagonal = (df == dr);
+                                bool reaches =
+                                        (type == whiteKing)   ? max(df, dr) == 1 :
+                                        (type == whiteQueen)  ? line || diagonal :
+                                        (type == whiteRook)   ? line :
+                                        (type == whiteBishop) ? diagonal :
+                                        /* whiteKnight */       df * dr == 2;
+                                if (!reaches)
+                                        continue;
+
+                                // Insert, kicking out entries to their other slot until one is empty
+                                uint64_t key = zobristPiece[piece][from] ^ zobristPiece[piece][to] ^ zobristTurn[0];
+                                short move = move(from, to);
+                                for (int i=cuckoo1(key); move; i=(i == cuckoo1(key)) ? cuckoo2(key) : cuckoo1(key)) {
+                                        uint64_t swapKey = cuckooKeys[i];
+                                        short swapMove = cuckooMoves[i];
+                                        cuckooKeys[i] = key;
+                                        cuckooMoves[i] = move;
+                                        key = swapKey;
+                                        move = swapMove;
+                                }
+                                count++;
+                        }
+        }
+        assert(count == 3668);
+}
+
+// Squares strictly between `from' and `to' are empty (trivially so for knights)
+static bool isClearPath(Board_t board, int from, int to)
+{
+        int df = file(to) - file(from), dr = rank(to) - rank(from);
+        if (df != 0 && dr != 0 && abs(df) != abs(dr))
+                return true;
+        int step = ((df > 0) - (df < 0)) * (b1 - a1) + ((dr > 0) - (dr < 0)) * (a2 - a1);
+        for (int square=from+step; square!=to; square+=step)
+                if (board->squares[square] != empty)
+                        return false;
+        return true;
+}
+
+// A reversible move leads to a repetition (as defined by `repetition')
+static bool upcomingRepetition(Engine_t self)
+{
+        Board_t board = board(self);
+        int len = board->hashHistory.len;
+        int end = min(board->halfmoveClock, len);
+        if (end < 3)
+                return false;
+
+        for (int i=3; i<=end; i+=2) {
+                uint64_t moveKey = board->hash ^ board->hashHistory.v[len-i];
+                int j = cuckoo1(moveKey);
+                if (cuckooKeys[j] != moveKey) {
+                        j = cuckoo2(moveKey);
+                        if (cuckooKeys[j] != moveKey)
+                                continue;
+                }
+
+                int from = from(cuckooMoves[j]), to = to(cuckooMoves[j]);
+                if (!isClearPath(board, from, to))
+                        continue;
+
+                if (i <= ply(self))
+                        return true; // A repetition inside the tree
+
+                // Before the root it must be our move, to a position seen twice already
+                int square = (board->squares[from] != empty) ? from : to;
+                if (pieceColor(board->squares[square]) != sideToMove(board))
+                        continue;
+                for (int k=i+4; k<=end; k+=2)
+                        if (board->hashHistory.v[len-k] == board->hashHistory.v[len-i])
+                                return true;
+        }
+        return false;
+}
+
+/*----------------------------------------------------------------------+
+ |      isSingularMove                                                  |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  The hash move is singular if it has a deep lower bound and a reduced
+ *  search of all other moves fails low against a somewhat lower bound.
+ *  This node's own table entry is left untouched: the excluded-move
+ *  search only writes entries for the child positions.
+ */
+static bool isSingularMove(Engine_t self, struct ttSlot slot, int depth, int pvDistance)
+{
+        if (depth < singularMinDepth || !slot.move || !slot.isLowerBound
+         || slot.depth < depth - singularMaxDepthDiff
+         || !inRange(slot.score, minEval, maxEval))
+                return false;
+
+        int singularAlpha = slot.score - singularMargin(depth);
+        int singularDepth = depth / 2;
+
+        struct Node node = { .slot = { .move = slot.move }, .excludedMove = slot.move };
+        for (int move=makeFirstMove(self,&node); move; move=makeNextMove(self,&node)) {
+                int score = -scout(self, singularDepth - 1, -(singularAlpha+1), pvDistance+1, move);
+                undoMove(board(self));
+                if (score > singularAlpha)
+                        return false;
+        }
+        return true;
+}
+
 /*----------------------------------------------------------------------+
  |      Lazy move generator                                             |
  +----------------------------------------------------------------------*/
 
+// The excluded move, if any, must also be the hash move
 static int makeFirstMove(Engine_t self, struct Node *node)
 {
+        node->quietLimit = minInt;
         node->phase = 0;
         int ttMove = node->moveList[0] = node->slot.move;
-        if (ttMove) {
+        if (ttMove && ttMove != node->excludedMove) {
                 makeMove(board(self), ttMove);
-                if (wasLegalMove(board(self)))
+                if (wasLegalMove(board(self))) {
+                        setContinuationKey(self, ttMove);
                         return ttMove;
+                }
                 undoMove(board(self));
         }
         return makeNextMove(self, node);
@@ -477,9 +1204,15 @@ static int makeNextMove(Engine_t self, struct Node *node)
         if (node->phase == 1)
                 while (node->i < node->nrMoves) {
                         int move = node->moveList[node->i++];
+                        if (isQuietMove(board(self), move)
+                         && moveHistory(move) < node->quietLimit
+                         && !isCheckingMove(board(self), move))
+                                continue; // Late quiet move, unlikely to fail high
                         makeMove(board(self), move);
-                        if (wasLegalMove(board(self)))
+                        if (wasLegalMove(board(self))) {
+                                setContinuationKey(self, move);
                                 return move;
+                        }
                         undoMove(board(self));
                 }
         return 0;
@@ -553,13 +1286,24 @@ static int compareMoves(const void *ap, const void *bp)
 
 static int filterAndSort(Engine_t self, int moveList[], int nrMoves, int moveFilter)
 {
+        const short *counter = self->continuationHistory[continuationKey(self, ply(self))];
+        const short *followup = self->continuationHistory[continuationKey(self, ply(self) - 1)];
+
         int j = 0;
         for (int i=0; i<nrMoves; i++) {
                 int moveScore = staticMoveScore(board(self), moveList[i]);
-                if (moveScore >= moveFilter)
+                if (moveScore >= moveFilter) {
+                        int move = moveList[i], history = 0;
+                        if (isQuietMove(board(self), move))
+                                history = quietHistory(self, move, counter, followup);
+                        else if (isCapture(board(self), move)) {
+                                history = *captureHistoryEntry(self, move) / (historyMax / historyOffset);
+                                history = max(-historyOffset, min(history, historyOffset - 1));
+                        }
                         moveList[j++] = (moveScore << 26)
-                                      + (self->historyCounts[historyIndex(moveList[i])] << 15)
+                                      + ((history + historyOffset) << 15)
                                       + (moveList[i] & moveMask);
+                }
         }
         qsort(moveList, j, sizeof(moveList[0]), compareMoves);
         return j;
@@ -593,6 +1337,10 @@ static void killersToFront(Engine_t self, int ply, int moveList[], int nrMoves)
         int j = 0; // Find insertion place: after the good captures
         while (j < nrMoves && moveScore(moveList[j]) >= 0) j++;
 
+        int lastMove = continuationKey(self, ply);
+        if (lastMove) // The counter move goes right after the killers
+                moveToFront(moveList+j, nrMoves-j, self->counterMoves[lastMove]);
+
         for (int i=nrKillers-1; i>=0; i--) // Bring killers forward, one by one in reverse order
                 moveToFront(moveList+j, nrMoves-j, self->killers.v[ply].v[i]);
 }
@@ -617,12 +1365,132 @@ static void updateKillers(Engine_t self, int ply, int move)
         }
 }
 
-static void updateHistory(short historyCounts[], int index, int depth)
+/*----------------------------------------------------------------------+
+ |      History tables                                                  |
+ +----------------------------------------------------------------------*/
+
+// Move entry towards +/-historyMax, with less effect the closer it gets
+static void updateHistory(short *entry, int bonus)
+{
+        *entry += bonus - *entry * abs(bonus) / historyMax;
+}
+
+// Reward the quiet move that failed high and punish the quiet moves tried before it
+static void updateQuietHistory(Engine_t self, int depth, int move, const int quiets[], int nrQuiets)
 {
-        historyCounts[index] += min(64, depth * depth); // Rookie v1
-        if (historyCounts[index] >= (1 << historyBits))
-                for (int i=0; i <= historyIndex(~0); i++)
-                        historyCounts[i] >>= 1;
+        Board_t board = board(self);
+        int lastMove = continuationKey(self, ply(self));
+        short *counter = self->continuationHistory[lastMove];
+        short *followup = self->continuationHistory[continuationKey(self, ply(self) - 1)];
+        bool hasFollowup = (followup != self->continuationHistory[0]);
+
+        int bonus = historyBonus(depth);
+        for (int i=-1; i<nrQuiets; i++) {
+                int m = (i < 0) ? move : quiets[i];
+                int ix = pieceToIndex(board->squares[from(m)], to(m));
+                updateHistory(&self->historyCounts[historyIndex(m)], bonus);
+                updateHistory(&self->pieceToHistory[ix], bonus);
+                if (lastMove)    updateHistory(&counter[ix], bonus);
+                if (hasFollowup) updateHistory(&followup[ix], bonus);
+                bonus = -historyBonus(depth); // Malus for the others
+        }
+
+        if (lastMove)
+                self->counterMoves[lastMove] = move & moveMask;
+}
+
+// Sum of all history tables for a quiet move, scaled to fit in the move list entry
+static int quietHistory(Engine_t self, int move, const short *counter, const short *followup)
+{
+        int ix = pieceToIndex(board(self)->squares[from(move)], to(move));
+        int sum = self->historyCounts[historyIndex(move)] + self->pieceToHistory[ix]
+                + counter[ix] + followup[ix];
+        int history = sum / (4 * historyMax / historyOffset);
+        return max(-historyOffset, min(history, historyOffset - 1));
+}
+
+// Capture history is indexed by moving piece, to-square and type of captured piece
+static short *captureHistoryEntry(Engine_t self, int move)
+{
+        Board_t board = board(self);
+        int ix = pieceToIndex(board->squares[from(move)], to(move));
+        int victim = board->squares[to(move)];
+        return &self->captureHistory[ix][victim - pieceColor(victim) * (blackKing - whiteKing)];
+}
+
+// Reward the capture that failed high and punish the captures tried before it
+static void updateCaptureHistory(Engine_t self, int depth, int move, const int captures[], int nrCaptures)
+{
+        updateHistory(captureHistoryEntry(self, move), historyBonus(depth));
+        for (int i=0; i<nrCaptures; i++)
+                updateHistory(captureHistoryEntry(self, captures[i]), -historyBonus(depth));
+}
+
+// Remember the [piece][to] index of the move just made, for continuation history
+static void setContinuationKey(Engine_t self, int move)
+{
+        int ply = ply(self);
+        while (self->continuationKeys.len <= ply) // Expand table when needed
+                pushList(self->continuationKeys, 0);
+        int to = to(move);
+        self->continuationKeys.v[ply] = move ? pieceToIndex(board(self)->squares[to], to) : 0;
+}
+
+// Index of the move leading to the node at `ply', or 0 if there is none
+static int continuationKey(Engine_t self, int ply)
+{
+        return (ply >= 0) ? self->continuationKeys.v[ply] : 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      ageMoveOrdering                                                 |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Carry move ordering over to the next root instead of starting cold:
+ *  halve all history scores, and shift the killers to the new root ply.
+ */
+static void ageMoveOrdering(Engine_t self, int pliesPlayed)
+{
+        #define halve(entries) Statement(\
+                for (int i=0; i<arrayLen(entries); i++)\
+                        (entries)[i] /= 2;\
+        )
+        halve(self->historyCounts);
+        halve(self->pieceToHistory);
+        for (int j=0; j<nrPieceTo; j++)
+                halve(self->captureHistory[j]);
+        if (self->continuationHistory)
+                for (int j=0; j<nrPieceTo; j++)
+                        halve(self->continuationHistory[j]);
+        #undef halve
+
+        if (inRange(pliesPlayed, 1, self->killers.len - 1)) {
+                self->killers.len -= pliesPlayed;
+                memmove(&self->killers.v[0], &self->killers.v[pliesPlayed],
+                        self->killers.len * sizeof self->killers.v[0]);
+        } else
+                self->killers.len = 0;
+}
+
+/*----------------------------------------------------------------------+
+ |      Late move reductions                                            |
+ +----------------------------------------------------------------------*/
+
+static void initReductionTable(void)
+{
+        for (int depth=1; depth<64; depth++)
+                for (int j=1; j<64; j++)
+                        reductionTable[depth][j] = 0.75 + log(depth) * log(j + 1) / 2.25;
+}
+
+// Reduction for the j-th move (counting from 0), before the `inCheck' exemptions
+static int lateMoveReduction(int depth, int j, int move, bool isCutNode)
+{
+        int reduction = reductionTable[min(depth, 63)][min(j, 63)];
+        reduction += isCutNode;
+        reduction -= moveHistory(move) >= lmrGoodHistory;
+        return max(0, reduction);
 }
 
 /*----------------------------------------------------------------------+
@@ -684,14 +1552,184 @@ static int updateBestAndPonderMove(Engine_t self)
         return !self->bestMove + !self->ponderMove; // 0, 1 or 2 halfmoves
 }
 
+/*----------------------------------------------------------------------+
+ |      Root moves                                                      |
+ +----------------------------------------------------------------------*/
+
+// Generate the legal root moves once per search, or take them from `searchmoves'
+static void prepareRootMoves(Engine_t self)
+{
+        int moveList[maxMoves];
+        int nrMoves = generateMoves(board(self), moveList);
+        if (self->searchMoves.len > 0) {
+                nrMoves = self->searchMoves.len;
+                memcpy(moveList, self->searchMoves.v, nrMoves * sizeof(int));
+        }
+        nrMoves = filterAndSort(self, moveList, nrMoves, minInt);
+        nrMoves = filterLegalMoves(board(self), moveList, nrMoves);
+
+        self->rootMoves.len = 0;
+        int oldMaxLen = self->rootMoves.maxLen;
+        preparePushList(self->rootMoves, nrMoves);
+        for (int i=oldMaxLen; i<self->rootMoves.maxLen; i++)
+                self->rootMoves.v[i].pv = (intList) emptyList;
+        for (int i=0; i<nrMoves; i++) {
+                struct rootMove *rootMove = &self->rootMoves.v[self->rootMoves.len++];
+                rootMove->move = moveList[i];
+                rootMove->score = minInt;
+                rootMove->nodeCount = 0;
+                rootMove->pv.len = 0;
+        }
+}
+
+static void updateRootMove(Engine_t self, int move, int score, long long nodeCount)
+{
+        for (int i=0; i<self->rootMoves.len; i++) {
+                struct rootMove *rootMove = &self->rootMoves.v[i];
+                if (rootMove->move == move) {
+                        rootMove->score = score;
+                        rootMove->nodeCount = nodeCount;
+                        return;
+                }
+        }
+}
+
+// Keep the PV of a root move that made it into the MultiPV lines
+static void updateRootLine(Engine_t self, int move, const int pv[], int pvLen)
+{
+        for (int i=0; i<self->rootMoves.len; i++) {
+                struct rootMove *rootMove = &self->rootMoves.v[i];
+                if (rootMove->move == move) {
+                        rootMove->pv.len = 0;
+                        for (int j=0; j<pvLen; j++)
+                                pushList(rootMove->pv, pv[j]);
+                        return;
+                }
+        }
+}
+
+// Score to beat to enter the top lines, or -maxInt while there are fewer lines
+static int multiPvBound(Engine_t self, int nrLines)
+{
+        int scores[maxMoves];
+        int n = 0;
+        for (int i=0; i<self->rootMoves.len; i++)
+                if (self->rootMoves.v[i].pv.len > 0)
+                        scores[n++] = self->rootMoves.v[i].score;
+        if (n < nrLines)
+                return -maxInt;
+        qsort(scores, n, sizeof(scores[0]), compareInt);
+        return scores[n-nrLines];
+}
+
+/*
+ *  Order for the next iteration: the best move first, then the other
+ *  MultiPV lines by score, then the rest by the size of their last subtree.
+ *  Moves that were hard to refute are the most likely to fail high later.
+ */
+static bool rootMoveBefore(const struct rootMove *a, const struct rootMove *b, int bestMove)
+{
+        bool aIsBest = (a->move & moveMask) == bestMove;
+        bool bIsBest = (b->move & moveMask) == bestMove;
+        if (aIsBest != bIsBest)
+                return aIsBest;
+        bool aIsLine = a->pv.len > 0;
+        bool bIsLine = b->pv.len > 0;
+        if (aIsLine != bIsLine)
+                return aIsLine;
+        return aIsLine ? a->score > b->score : a->nodeCount > b->nodeCount;
+}
+
+static void sortRootMoves(Engine_t self) // Insertion sort keeps ties stable
+{
+        struct rootMove *v = self->rootMoves.v;
+        int bestMove = self->bestMove & moveMask;
+        for (int i=1; i<self->rootMoves.len; i++) {
+                struct rootMove rootMove = v[i];
+                int j = i;
+                for (; j>0 && rootMoveBefore(&rootMove, &v[j-1], bestMove); j--)
+                        v[j] = v[j-1];
+                v[j] = rootMove;
+        }
+}
+
+static bool isRootMove(Engine_t self, int move)
+{
+        return findRootMove(self, move) != null;
+}
+
+struct rootMove *findRootMove(Engine_t self, int move)
+{
+        for (int i=0; i<self->rootMoves.len; i++)
+                if ((self->rootMoves.v[i].move & moveMask) == (move & moveMask) && move != 0)
+                        return &self->rootMoves.v[i];
+        return null;
+}
+
+/*
+ *  Take a move without searching. The hash move of the reply, if any,
+ *  becomes the ponder move.
+ */
+static void playInstantMove(Engine_t self, int move, int score, int depth)
+{
+        move &= moveMask;
+        self->pv.len = 0;
+        pushList(self->pv, move);
+        self->bestMove = move;
+        self->ponderMove = 0;
+
+        makeMove(board(self), move);
+        int reply = ttRead(self).move;
+        int moveList[maxMoves];
+        int nrMoves = generateMoves(board(self), moveList);
+        for (int i=0; i<nrMoves; i++)
+                if (moveList[i] == reply && reply != 0 && isLegalMove(board(self), reply)) {
+                        pushList(self->pv, reply);
+                        self->ponderMove = reply;
+                        break;
+                }
+        undoMove(board(self));
+
+        self->score = score;
+        self->depth = depth;
+}
+
+/*----------------------------------------------------------------------+
+ |      timeFactor                                                      |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Scale the target time by how settled the search looks: less when the
+ *  best move survived several iterations and takes most of the root nodes,
+ *  more when the best move just changed or when the score is dropping.
+ *  The caller keeps the result within maxTime.
+ */
+static double timeFactor(int stableIterations, int scoreDrop, double bestMoveShare)
+{
+        double factor = 1.0;
+
+        if (stableIterations == 0)
+                factor *= 1.4;
+        else if (stableIterations >= 3)
+                factor *= max(0.5, 1.1 - 0.1 * stableIterations);
+
+        if (stableIterations >= 2 && bestMoveShare > 0.8)
+                factor *= 0.8;
+
+        if (scoreDrop > 0) // In millipawns, up to double time for half a pawn
+                factor *= 1.0 + min(scoreDrop, 500) / 500.0;
+
+        return factor;
+}
+
 /*----------------------------------------------------------------------+
  |      setTimeTargets                                                  |
  +----------------------------------------------------------------------*/
 
-static double target(double time, double inc, int movestogo)
+static double target(double time, double inc, int movestogo, double overhead)
 {
         double safety = (inc < 0.05) ? 20.0 : 2.5;
-        double target = (time + (movestogo - 1) * inc - safety) / movestogo;
+        double target = (time + (movestogo - 1) * inc - safety) / movestogo - overhead;
         return max(target, 0.05);
 }
 
@@ -707,10 +1745,17 @@ void setTimeTargets(Engine_t self, double time, double inc, int movestogo, doubl
                 case 45: movestogo = min(movestogo, 2); break;
                 }
                 int mintogo = max(1, movestogo / 5); // Upto 5 times the target
-                self->target.time = target(time, inc, movestogo);
-                double panicTime = target(time, inc, mintogo);
-                double flagTime = target(time, inc, 1);
+                double overhead = self->target.moveOverhead;
+                self->target.time = target(time, inc, movestogo, overhead);
+                double panicTime = target(time, inc, mintogo, overhead);
+                double flagTime = target(time, inc, 1, overhead);
                 self->target.maxTime  = min(panicTime, flagTime);
+                if (self->target.nodeRate > 0.0) {
+                        // Play on nodes, keeping the wall clock only as a safety net
+                        long long maxNodes = self->target.maxTime * self->target.nodeRate;
+                        self->target.nodeCount = min(self->target.nodeCount, max(maxNodes, 1));
+                        self->target.maxTime = flagTime;
+                }
         } else
                 self->target.time = self->target.maxTime = 0.0;
         if (movetime > 0.0)
@@ -95,7 +95,6 @@ void uciBenchmark(Engine_t self, double time, int bestOf)
         char oldPosition[maxFenSize]; // TODO: clone engine and then share tt instead
         boardToFen(board(self), oldPosition);
 
-        kpkGenerate(); // Initialize before measuring speed
         printf("egt class KPK check %s\n", kpkSelfCheck() ? "OK" : "FAILED");
 
         #define N arrayLen(positions)
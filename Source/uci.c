@@ -36,6 +36,9 @@
 #include "Engine.h"
 #include "uci.h"
 
+// Other modules
+#include "egt.h"
+
 /*----------------------------------------------------------------------+
  |      Definitions                                                     |
  +----------------------------------------------------------------------*/
@@ -43,8 +46,22 @@
 struct options {
         long Hash;
         bool ClearHash;
+        long NodesTime; // nodes per millisecond, 0 for the wall clock
+        long MoveOverhead; // milliseconds
+        bool CpuTimeAware;
+        bool AgeHistory;
+        long MultiPV;
+        long PonderReplies; // expected replies to ponder on
+        bool MateSolver; // proof-number search for `go mate'
+        char EndgamePath[256]; // cache directory for endgame tables, `<empty>' for none
+        bool ProbabilitySearch; // probability density search instead of PVS
+        bool MtdSearch; // MTD(f) zero-window driver instead of PVS
 };
 #define maxHash ((sizeof(size_t) > 4) ? 64 * 1024L : 1024L)
+#define maxNodesTime 100000L
+#define maxMoveOverhead 5000L
+#define maxMultiPV 64L
+#define maxPonderReplies 3L
 
 #define ms (1e-3)
 #define MiB (1ULL << 20)
@@ -105,6 +122,10 @@ X"  bench [ movetime <millis> ] [ bestof <repeat> ]"
 X"        Speed test using 40 standard positions. Default: movetime 333 bestof 3"
 X"  moves [ depth <ply> ]"
 X"        Move generation test. Default: depth 1"
+X"  stats"
+X"        Show the maximum and 99th percentile time from a stop or timeout"
+X"        until `bestmove', over the most recent searches, and the share of"
+X"        the pondering that went into the replies actually played."
 X
 X"Unknown commands and options are silently ignored, except in debug mode."
 X;
@@ -113,9 +134,46 @@ X;
  |      Functions                                                       |
  +----------------------------------------------------------------------*/
 
-static xThread_t stopSearch(Engine_t self, xThread_t searchThread);
-static xThread_t startSearch(Engine_t self);
+/*
+ *  Searches run on a long-lived worker thread that waits for the next `go'
+ */
+struct searchWorker {
+        Engine_t engine;
+        xThread_t thread;       // created on the first `go'
+        xEvent_t start;         // set to start a search
+        xEvent_t idle;          // set while no search is running
+        volatile bool quit;
+
+        // From abortSearch to `bestmove', in microseconds, for `stats'
+        int abortLatencies[1024]; // the most recent ones
+        long nrAborts;
+
+        // With more than one ponder reply the search runs in the position
+        // before the expected reply, with a line for each candidate reply
+        bool speculative;
+        int ponderMove;         // the expected reply, taken back while searching
+        int nrReplies;          // replies pondered on
+        uint64_t replyHash;     // position before the reply
+        int multiPv;            // restored afterwards, with the node limit
+        long long nodeCount;
+        intPair replyLine;      // best move and ponder move after the reply
+        bool creditPending;     // until the actual reply is known
+
+        // Ponder nodes, and those spent on the reply that was played
+        long long ponderNodes;
+        long long usefulPonderNodes;
+};
+
+static void startSearch(struct searchWorker *worker);
+static void stopSearch(struct searchWorker *worker);
+static void stopWorker(struct searchWorker *worker);
+static void endPondering(Engine_t self);
 static void uciBestMove(Engine_t self);
+static void uciStats(struct searchWorker *worker);
+static void uciPonderInfo(void *uciInfoData);
+static void endSpeculation(struct searchWorker *worker);
+static void creditPondering(struct searchWorker *worker, int reply);
+static void uciInfoLine(Engine_t self, int lineNumber, int score, const int pv[], int pvLen);
 
 static void updateOptions(Engine_t self,
         struct options *options, const struct options *newOptions);
@@ -141,6 +199,17 @@ static int _scanToken(char **line, const char *format, void *value)
 #define scanValue(tokens, value) _scanToken(&line, " " tokens "%c %n", value)
 #define scan(tokens) scanValue(tokens, null)
 
+// String option values run to the end of the line and may contain spaces
+static void _scanString(char **line, char *value, int size)
+{
+        int n = strlen(*line);
+        while (n > 0 && isspace((*line)[n-1]))
+                n--;
+        snprintf(value, size, "%.*s", n, *line);
+        *line += strlen(*line);
+}
+#define scanString(tokens, value) (scan(tokens) && (_scanString(&line, value, sizeof(value)), true))
+
 // For skipping unknown commands or options
 #define skipOneToken(type) Statement(\
         while (isspace(*line)) line++;        \
@@ -159,10 +228,16 @@ void uciMain(Engine_t self)
         charList lineBuffer = emptyList;
         bool debug = false;
         struct options oldOptions = { .Hash = -1 };
-        struct options newOptions = { .Hash = 128 };
+        struct options newOptions = { .Hash = 128, .MoveOverhead = 10, .AgeHistory = true, .MultiPV = 1,
+                                     .PonderReplies = 1, .MateSolver = true, .EndgamePath = "<empty>" };
 
         // Prepare threading
-        xThread_t searchThread = null;
+        struct searchWorker worker = { .engine = self };
+
+        // Previous `position' arguments, to play only the new moves of a game
+        charList lastPosition = emptyList;
+        uint64_t lastPositionHash = 0;
+        int lastMove = 0; // last move played by `position', if any
 
         // Process commands
         while (readLine(stdin, &lineBuffer) != 0) {
@@ -175,8 +250,22 @@ void uciMain(Engine_t self)
                                "option name Hash type spin default %ld min 0 max %ld\n"
                                "option name Clear Hash type button\n"
                                "option name Ponder type check default true\n"
+                               "option name nodestime type spin default 0 min 0 max %ld\n"
+                               "option name Move Overhead type spin default %ld min 0 max %ld\n"
+                               "option name CPU Time Aware type check default false\n"
+                               "option name Age History type check default %s\n"
+                               "option name MultiPV type spin default 1 min 1 max %ld\n"
+                               "option name Ponder Replies type spin default 1 min 1 max %ld\n"
+                               "option name Mate Solver type check default %s\n"
+                               "option name Endgame Path type string default %s\n"
+                               "option name Probability Search type check default false\n"
+                               "option name MTD Search type check default false\n"
                                "uciok\n",
-                                newOptions.Hash, maxHash);
+                                newOptions.Hash, maxHash, maxNodesTime,
+                                newOptions.MoveOverhead, maxMoveOverhead,
+                                newOptions.AgeHistory ? "true" : "false", maxMultiPV,
+                                maxPonderReplies, newOptions.MateSolver ? "true" : "false",
+                                newOptions.EndgamePath);
 
                 else if (scan("debug")) {
                         if (scan("on")) debug = true;
@@ -188,6 +277,21 @@ void uciMain(Engine_t self)
                         else if (scan("name Ponder value true")) pass;
                         else if (scan("name Ponder value false")) pass; // just ignore it
                         else if (scan("name Clear Hash")) newOptions.ClearHash = !oldOptions.ClearHash;
+                        else if (scanValue("name nodestime value %ld", &newOptions.NodesTime)) pass;
+                        else if (scanValue("name Move Overhead value %ld", &newOptions.MoveOverhead)) pass;
+                        else if (scan("name CPU Time Aware value true")) newOptions.CpuTimeAware = true;
+                        else if (scan("name CPU Time Aware value false")) newOptions.CpuTimeAware = false;
+                        else if (scan("name Age History value true")) newOptions.AgeHistory = true;
+                        else if (scan("name Age History value false")) newOptions.AgeHistory = false;
+                        else if (scanValue("name MultiPV value %ld", &newOptions.MultiPV)) pass;
+                        else if (scanValue("name Ponder Replies value %ld", &newOptions.PonderReplies)) pass;
+                        else if (scan("name Mate Solver value true")) newOptions.MateSolver = true;
+                        else if (scan("name Mate Solver value false")) newOptions.MateSolver = false;
+                        else if (scanString("name Endgame Path value", newOptions.EndgamePath)) pass;
+                        else if (scan("name Probability Search value true")) newOptions.ProbabilitySearch = true;
+                        else if (scan("name Probability Search value false")) newOptions.ProbabilitySearch = false;
+                        else if (scan("name MTD Search value true")) newOptions.MtdSearch = true;
+                        else if (scan("name MTD Search value false")) newOptions.MtdSearch = false;
                 }
                 else if (scan("isready")) {
                         updateOptions(self, &oldOptions, &newOptions);
@@ -197,25 +301,51 @@ void uciMain(Engine_t self)
                         pass;
 
                 else if (scan("position")) {
-                        searchThread = stopSearch(self, searchThread);
-
-                        if (scan("startpos"))
+                        stopSearch(&worker);
+                        char *arguments = line;
+
+                        int n = lastPosition.len;
+                        bool extends = n > 0 && board(self)->hash == lastPositionHash
+                                    && strncmp(line, lastPosition.v, n) == 0
+                                    && (line[n] == '\0' || isspace(line[n]));
+                        bool reusable = true;
+                        if (extends)
+                                line += n; // Keep the game, play only the new moves
+                        else if (scan("startpos"))
                                 setupBoard(board(self), startpos);
                         else if (scan("fen")) {
                                 int n = setupBoard(board(self), line);
                                 if (debug && n == 0) printf("info string Invalid position\n");
+                                reusable = (n > 0);
                                 line += n;
                         }
 
-                        if (scan("moves"))
+                        if (!extends)
+                                lastMove = 0;
+                        if (scan("moves") || extends)
                                 for (int n=1; n>0; line+=n) {
                                         int moves[maxMoves], move;
                                         int nrMoves = generateMoves(board(self), moves);
                                         n = parseUciMove(board(self), line, moves, nrMoves, &move);
-                                        if (n > 0 && move > 0) makeMove(board(self), move);
-                                        else if (n > 0) { skipOneToken("Illegal move"); break; }
+                                        if (n > 0 && move > 0) { makeMove(board(self), move); lastMove = move; }
+                                        else if (n > 0) { skipOneToken("Illegal move"); reusable = false; break; }
                                 }
 
+                        lastPosition.len = 0;
+                        if (reusable)
+                                for (char *s=arguments; s<line; s++)
+                                        pushList(lastPosition, *s);
+                        while (lastPosition.len > 0 && isspace(lastPosition.v[lastPosition.len-1]))
+                                lastPosition.len--;
+                        lastPositionHash = board(self)->hash;
+
+                        if (worker.creditPending) { // Which of the pondered replies was played?
+                                uint64List *history = &board(self)->hashHistory;
+                                bool isReply = history->len > 0 && lastMove != 0
+                                            && history->v[history->len-1] == worker.replyHash;
+                                creditPondering(&worker, isReply ? lastMove : 0);
+                        }
+
                         if (debug) { // dump FEN and board
                                 char fen[maxFenSize];
                                 boardToFen(board(self), fen);
@@ -231,7 +361,9 @@ void uciMain(Engine_t self)
                         }
                 }
                 else if (scan("go")) {
-                        searchThread = stopSearch(self, searchThread);
+                        stopSearch(&worker);
+                        if (worker.creditPending)
+                                creditPondering(&worker, 0); // No new position
                         updateOptions(self, &oldOptions, &newOptions);
 
                         self->infoFunction = uciSearchInfo;
@@ -245,9 +377,10 @@ void uciMain(Engine_t self)
                         int movestogo = 0;
                         int mate = 0;
                         long movetime = 0;
+                        bool ponder = false;
 
                         while (*line != '\0')
-                                if ((scan("ponder") && (self->pondering = true))
+                                if ((scan("ponder") && (self->pondering = ponder = true))
                                  || scanValue("wtime %ld", &time)  || scanValue("winc %ld", &inc)
                                  || scanValue("btime %ld", &btime) || scanValue("binc %ld", &binc)
                                  || scanValue("movestogo %d", &movestogo)
@@ -273,16 +406,51 @@ void uciMain(Engine_t self)
                         setTimeTargets(self, time * ms, inc * ms, movestogo, movetime * ms);
                         self->target.scores.v[0] = minMate - 2 * min(0, mate); // for "mate -n"
                         self->target.scores.v[1] = maxMate - 2 * max(0, mate); // for "mate n"
-                        searchThread = startSearch(self);
+                        self->target.mate = newOptions.MateSolver ? mate : 0;
+
+                        if (ponder && lastMove != 0) {
+                                uint64List *history = &board(self)->hashHistory;
+                                worker.ponderMove = lastMove;
+                                worker.nrReplies = 1;
+                                worker.replyHash = history->v[history->len-1];
+                        }
+                        if (ponder && newOptions.PonderReplies > 1 && lastMove != 0
+                         && self->searchMoves.len == 0) {
+                                // Take back the expected reply and ponder on the best few
+                                undoMove(board(self));
+                                worker.speculative = true;
+                                worker.replyLine = (intPair) {{ 0, 0 }};
+                                worker.nrReplies = min(newOptions.PonderReplies, maxPonderReplies);
+                                worker.multiPv = self->multiPv;
+                                worker.nodeCount = self->target.nodeCount;
+                                self->multiPv = worker.nrReplies;
+                                self->infoFunction = uciPonderInfo;
+                                self->infoData = &worker;
+                        }
+                        startSearch(&worker);
                 }
                 else if (scan("stop")) {
-                        self->pondering = false;
-                        searchThread = stopSearch(self, searchThread);
+                        bool speculative = worker.speculative;
+                        worker.creditPending = self->pondering && worker.ponderMove != 0;
+                        endPondering(self);
+                        stopSearch(&worker);
+                        if (speculative)
+                                uciBestMove(self);
                 }
                 else if (scan("ponderhit")) {
-                        if (self->pondering)
+                        if (worker.speculative) {
+                                // Search the actual position, warmed up by the pondering
+                                stopSearch(&worker);
+                                creditPondering(&worker, worker.ponderMove);
+                                self->infoFunction = uciSearchInfo;
+                                self->infoData = self;
+                                startSearch(&worker);
+                        } else if (self->pondering) {
+                                if (worker.ponderMove != 0)
+                                        creditPondering(&worker, worker.ponderMove);
                                 self->alarmHandle = setAlarm(self->target.maxTime, abortSearch, self);
-                        self->pondering = false;
+                        }
+                        endPondering(self);
                 }
                 else if (scan("quit")) {
                         skipOtherTokens();
@@ -306,6 +474,9 @@ void uciMain(Engine_t self)
                         scanValue("bestof %d", &bestof);
                         uciBenchmark(self, movetime * ms, bestof);
                 }
+                else if (scan("stats"))
+                        uciStats(&worker);
+
                 else if (scan("moves")) {
                         int depth = 1;
                         scanValue("depth %d", &depth);
@@ -318,7 +489,8 @@ void uciMain(Engine_t self)
                 fflush(stdout);
         }
 
-        searchThread = stopSearch(self, searchThread);
+        stopWorker(&worker);
+        freeList(lastPosition);
         freeList(lineBuffer);
 }
 
@@ -333,6 +505,16 @@ static void updateOptions(Engine_t self,
                 ttSetSize(self, max(0, newOptions->Hash) * MiB);
         if (newOptions->ClearHash != oldOptions->ClearHash)
                 ttClearFast(self);
+        self->target.nodeRate = min(max(0, newOptions->NodesTime), maxNodesTime) / ms;
+        self->target.moveOverhead = min(max(0, newOptions->MoveOverhead), maxMoveOverhead) * ms;
+        self->target.watchCpuTime = newOptions->CpuTimeAware;
+        self->ageHistory = newOptions->AgeHistory;
+        self->multiPv = min(max(1, newOptions->MultiPV), maxMultiPV);
+        self->pds = newOptions->ProbabilitySearch;
+        self->mtd = newOptions->MtdSearch;
+        const char *path = strcmp(newOptions->EndgamePath, "<empty>") ? newOptions->EndgamePath : "";
+        if (!egtStart(path) && strcmp(newOptions->EndgamePath, oldOptions->EndgamePath))
+                printf("info string Endgame Path change ignored until restart\n");
         *oldOptions = *newOptions;
 }
 
@@ -343,19 +525,33 @@ static void updateOptions(Engine_t self,
 void uciSearchInfo(void *uciInfoData)
 {
         Engine_t self = uciInfoData;
+
+        // The main line, then any further MultiPV lines from the root moves
+        uciInfoLine(self, 1, self->score, self->pv.v, self->pv.len);
+        for (int i=1, k=2; i<self->rootMoves.len && k<=self->multiPv; i++) {
+                struct rootMove *rootMove = &self->rootMoves.v[i];
+                if (rootMove->pv.len > 0)
+                        uciInfoLine(self, k++, rootMove->score, rootMove->pv.v, rootMove->pv.len);
+        }
+}
+
+static void uciInfoLine(Engine_t self, int lineNumber, int score, const int pv[], int pvLen)
+{
         charList infoLine = emptyList; // Construct the info line in a thread-safe manner
 
         long milliSeconds = round(self->seconds / ms);
         listPrintf(&infoLine, "info time %ld", milliSeconds);
 
-        if (self->pv.len > 0 || self->depth == 0) {
-                listPrintf(&infoLine, " depth %d score ", self->depth);
-                if (isMateScore(self->score))
-                        listPrintf(&infoLine, "mate %d",
-                                (self->score < 0) ? (minMate - self->score    ) / 2
-                                                  : (maxMate - self->score + 1) / 2);
+        if (pvLen > 0 || self->depth == 0) {
+                listPrintf(&infoLine, " depth %d", self->depth);
+                if (self->multiPv > 1)
+                        listPrintf(&infoLine, " multipv %d", lineNumber);
+                if (isMateScore(score))
+                        listPrintf(&infoLine, " score mate %d",
+                                (score < 0) ? (minMate - score    ) / 2
+                                            : (maxMate - score + 1) / 2);
                 else
-                        listPrintf(&infoLine, "cp %.0f", round(self->score / 10.0));
+                        listPrintf(&infoLine, " score cp %.0f", round(score / 10.0));
         }
 
         double nps = (self->seconds > 0.0) ? self->nodeCount / self->seconds : 0.0;
@@ -364,9 +560,9 @@ void uciSearchInfo(void *uciInfoData)
         double ttLoad = ttCalcLoad(self);
         listPrintf(&infoLine, " hashfull %d", (int) round(ttLoad * 1000.0));
 
-        for (int i=0; i<self->pv.len; i++) {
+        for (int i=0; i<pvLen; i++) {
                 char moveString[maxMoveSize];
-                moveToUci(moveString, self->pv.v[i]);
+                moveToUci(moveString, pv[i]);
                 listPrintf(&infoLine, "%s %s", (i == 0) ? " pv" : "", moveString);
         }
 
@@ -398,32 +594,165 @@ static void uciBestMove(Engine_t self)
         fflush(stdout);
 }
 
+/*----------------------------------------------------------------------+
+ |      uciStats                                                        |
+ +----------------------------------------------------------------------*/
+
+static void uciStats(struct searchWorker *worker)
+{
+        int latencies[arrayLen(worker->abortLatencies)];
+        int n = min(worker->nrAborts, arrayLen(latencies));
+        memcpy(latencies, worker->abortLatencies, n * sizeof(latencies[0]));
+        qsort(latencies, n, sizeof(latencies[0]), compareInt);
+
+        printf("info string aborts %ld", worker->nrAborts);
+        if (n > 0) {
+                int p99 = latencies[(99 * n + 99) / 100 - 1];
+                printf(" latency max %.3f ms p99 %.3f ms", latencies[n-1] * 1e-3, p99 * 1e-3);
+        }
+        if (worker->ponderNodes > 0)
+                printf(" ponder useful %.0f%%", 100.0 * worker->usefulPonderNodes / worker->ponderNodes);
+        putchar('\n');
+}
+
+/*----------------------------------------------------------------------+
+ |      Speculative pondering                                           |
+ +----------------------------------------------------------------------*/
+
+/*
+ *  Show the line of the expected reply, as seen after that reply
+ */
+static void uciPonderInfo(void *uciInfoData)
+{
+        struct searchWorker *worker = uciInfoData;
+        Engine_t self = worker->engine;
+
+        struct rootMove *rootMove = findRootMove(self, worker->ponderMove);
+        if (rootMove && rootMove->pv.len > 1) {
+                int score = -rootMove->score;
+                if (isMateScore(score))
+                        score += (score > 0) ? 1 : -1; // One ply closer
+                uciInfoLine(self, 1, score, &rootMove->pv.v[1], rootMove->pv.len - 1);
+                worker->replyLine.v[0] = rootMove->pv.v[1];
+                worker->replyLine.v[1] = (rootMove->pv.len > 2) ? rootMove->pv.v[2] : 0;
+        }
+}
+
+/*
+ *  Replay the expected reply after the search has stopped, and take
+ *  the best move and ponder move from its last line
+ */
+static void endSpeculation(struct searchWorker *worker)
+{
+        Engine_t self = worker->engine;
+        makeMove(board(self), worker->ponderMove);
+        self->multiPv = worker->multiPv;
+        self->target.nodeCount = worker->nodeCount; // Cleared by abortSearch
+        worker->speculative = false;
+        self->bestMove = worker->replyLine.v[0];
+        self->ponderMove = worker->replyLine.v[1];
+}
+
+/*
+ *  Account the pondering by the share that went into the reply actually
+ *  played (0 if unknown). With several replies that is the share of their
+ *  subtrees in the last iteration.
+ */
+static void creditPondering(struct searchWorker *worker, int reply)
+{
+        Engine_t self = worker->engine;
+        double share = (reply != 0 && reply == worker->ponderMove) ? 1.0 : 0.0;
+        if (worker->nrReplies > 1) {
+                long long total = 0;
+                for (int i=0; i<self->rootMoves.len; i++)
+                        total += self->rootMoves.v[i].nodeCount;
+                struct rootMove *rootMove = findRootMove(self, reply);
+                share = (rootMove && total > 0) ? (double) rootMove->nodeCount / total : 0.0;
+        }
+
+        worker->ponderNodes += self->nodeCount;
+        worker->usefulPonderNodes += round(self->nodeCount * share);
+        worker->ponderMove = 0;
+        worker->creditPending = false;
+}
+
 /*----------------------------------------------------------------------+
  |      startSearch / stopSearch                                        |
  +----------------------------------------------------------------------*/
 
-static void searchThreadStart(void *args)
+static void searchWorkerMain(void *args)
+{
+        struct searchWorker *worker = args;
+        for (;;) {
+                waitEvent(worker->start);
+                resetEvent(worker->start);
+                if (worker->quit)
+                        break;
+                Engine_t self = worker->engine;
+                if (self->target.mate != 0)
+                        mateSearch(self);
+                else
+                        rootSearch(self);
+                waitEvent(self->ponderEnd); // Hold back `bestmove' while pondering
+                if (!worker->speculative) // Otherwise not a result for this position
+                        uciBestMove(self);
+                if (self->abortTime > 0.0) {
+                        int micros = round((xTime() - self->abortTime) * 1e6);
+                        int i = worker->nrAborts++ % arrayLen(worker->abortLatencies);
+                        worker->abortLatencies[i] = micros;
+                }
+                setEvent(worker->idle);
+        }
+}
+
+static void startSearch(struct searchWorker *worker)
 {
-        Engine_t self = args;
-        rootSearch(self);
-        while (self->pondering)
-                pass; // TODO: change into a sempahore
-        uciBestMove(self);
+        Engine_t self = worker->engine;
+        if (!worker->thread) {
+                worker->start = createEvent();
+                worker->idle = createEvent();
+                worker->thread = createThread(searchWorkerMain, worker);
+        }
+        if (!self->ponderEnd)
+                self->ponderEnd = createEvent();
+        if (self->pondering)
+                resetEvent(self->ponderEnd);
+        else
+                setEvent(self->ponderEnd);
+        self->abortTime = 0.0;
+        resetEvent(worker->idle);
+        setEvent(worker->start);
 }
 
-static xThread_t startSearch(Engine_t args)
+static void stopSearch(struct searchWorker *worker)
 {
-        return createThread(searchThreadStart, args);
+        if (worker->thread) {
+                endPondering(worker->engine);
+                abortSearch(worker->engine);
+                waitEvent(worker->idle);
+                if (worker->speculative)
+                        endSpeculation(worker);
+        }
 }
 
-static xThread_t stopSearch(Engine_t self, xThread_t searchThread)
+static void stopWorker(struct searchWorker *worker)
 {
-        if (searchThread != null) {
-                self->pondering = false;
-                abortSearch(self);
-                joinThread(searchThread);
+        if (worker->thread) {
+                stopSearch(worker);
+                worker->quit = true;
+                setEvent(worker->start);
+                joinThread(worker->thread);
+                destroyEvent(worker->start);
+                destroyEvent(worker->idle);
+                worker->thread = null;
         }
-        return null;
+}
+
+static void endPondering(Engine_t self)
+{
+        self->pondering = false;
+        if (self->ponderEnd)
+                setEvent(self->ponderEnd);
 }
 
 /*----------------------------------------------------------------------+
@@ -0,0 +1,49 @@
+
+# Check that the engine doesn't burn CPU while it waits for `stop' after
+# finishing `go infinite' early (here on a mate in 1).
+# Usage: python Tools/idletest.py [engine [seconds [maxCpuShare]]]
+
+import resource
+import subprocess
+import sys
+import time
+
+engine = sys.argv[1] if len(sys.argv) > 1 else './floyd'
+seconds = float(sys.argv[2]) if len(sys.argv) > 2 else 2.0
+maxCpuShare = float(sys.argv[3]) if len(sys.argv) > 3 else 0.25
+
+mateIn1 = '6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1'
+
+process = subprocess.Popen([engine], stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                           universal_newlines=True)
+
+def send(command):
+        process.stdin.write(command + '\n')
+        process.stdin.flush()
+
+def expect(prefix):
+        while True:
+                line = process.stdout.readline()
+                if not line:
+                        sys.exit('engine exited early')
+                if line.startswith(prefix):
+                        return line
+
+send('setoption name Endgame Path value <empty>')
+send('isready')
+expect('readyok')
+send('position fen ' + mateIn1)
+send('go infinite')
+time.sleep(seconds) # The search is done long before this
+send('stop')
+expect('bestmove')
+send('quit')
+process.wait()
+
+# All CPU time of the engine, start-up and the search included
+usage = resource.getrusage(resource.RUSAGE_CHILDREN)
+cpu = usage.ru_utime + usage.ru_stime
+share = cpu / seconds
+print('idle %.1f s cpu %.3f s share %.3f max %.3f %s' %
+      (seconds, cpu, share, maxCpuShare, 'OK' if share <= maxCpuShare else 'NOK'))
+sys.exit(0 if share <= maxCpuShare else 1)
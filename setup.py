@@ -5,12 +5,14 @@ floydModule = Extension(
         'floyd',
         sources = [
                 'Source/cplus.c',
+                'Source/egt.c',
                 'Source/engine.c',
                 'Source/evaluate.c',
                 'Source/floydmodule.c',
                 'Source/format.c',
                 'Source/moves.c',
                 'Source/kpk.c',
+                'Source/mate.c',
                 'Source/parse.c',
                 'Source/search.c',
                 'Source/test.c',